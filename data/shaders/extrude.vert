@@ -5,14 +5,25 @@
 // if that vertex has a w coordinate of 0. It is assumed that the
 // provided light position is in local space to the object.
 //
+// Lights with a radius give a far plane, (normal, distance from the
+// light), and vertices are only extruded as far as it. Otherwise the
+// far plane's distance is 0 and vertices go out to infinity.
+//
 
 uniform vec4 lightPos;
+uniform vec4 farPlane;
 
 void main()
 {
 	vec4 v = gl_Vertex;
 
-	if (v.w == 0.0)
+	if (v.w == 0.0 && farPlane.w > 0.0)
+	{
+		vec3 d = gl_Vertex.xyz - lightPos.xyz;
+		v.xyz = lightPos.xyz + d * (farPlane.w / dot(farPlane.xyz, d));
+		v.w = 1.0;
+	}
+	else if (v.w == 0.0)
 	{
 	// These transformations handle point and directional lights by
 	// using the w component of all vertices.
@@ -24,4 +35,3 @@ void main()
 	gl_Position = gl_ModelViewProjectionMatrix * v;
 	gl_FrontColor = gl_Color;
 }
-
@@ -0,0 +1,53 @@
+//
+// Light Vertex Shader.
+//
+// Per vertex lighting from GL_LIGHT0, the same as the fixed function
+// pipeline except that a point light with a radius fades out smoothly and
+// has no effect at all past the radius. The GL's own attenuation never
+// reaches zero, so casters out of range couldn't be skipped without them
+// visibly changing.
+//
+
+uniform float lightRadius;
+
+void main()
+{
+	vec4 eyePos = gl_ModelViewMatrix * gl_Vertex;
+	vec3 n = normalize(gl_NormalMatrix * gl_Normal);
+
+	vec4 lightPos = gl_LightSource[0].position;
+	vec3 l = lightPos.xyz - lightPos.w * eyePos.xyz;
+	float dist = length(l);
+	l = normalize(l);
+
+	float attenuation = 1.0;
+	if (lightPos.w != 0.0)
+	{
+		attenuation = 1.0 / (gl_LightSource[0].constantAttenuation +
+			gl_LightSource[0].linearAttenuation * dist +
+			gl_LightSource[0].quadraticAttenuation * dist * dist);
+
+		if (lightRadius > 0.0)
+		{
+			float r = dist / lightRadius;
+			float window = clamp(1.0 - r * r * r * r, 0.0, 1.0);
+			attenuation *= window * window;
+		}
+	}
+
+	float diffuse = max(dot(n, l), 0.0);
+	vec4 color = gl_FrontLightModelProduct.sceneColor +
+		gl_FrontLightProduct[0].ambient * attenuation +
+		gl_FrontLightProduct[0].diffuse * diffuse * attenuation;
+
+	if (diffuse > 0.0)
+	{
+		vec3 h = normalize(l + vec3(0.0, 0.0, 1.0));
+		color += gl_FrontLightProduct[0].specular * attenuation *
+			pow(max(dot(n, h), 0.0), gl_FrontMaterial.shininess);
+	}
+
+	gl_FrontColor = vec4(color.rgb, gl_FrontMaterial.diffuse.a);
+	gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;
+	gl_Position = ftransform();
+}
@@ -0,0 +1,13 @@
+//
+// Shadow Volume Vertex Shader.
+//
+// Passes the local space vertex straight through, the geometry shader does
+// all of the work.
+//
+
+#version 150 compatibility
+
+void main()
+{
+	gl_Position = gl_Vertex;
+}
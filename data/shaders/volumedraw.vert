@@ -0,0 +1,29 @@
+//
+// Computed Shadow Volume Vertex Shader.
+//
+// Draws the triangles found by volume.comp. There are no vertex arrays,
+// each index is (world vertex * 4 + kind): the vertex itself, the vertex
+// extruded away from the light, or the vertex pushed onto the far plane so
+// that it always fails the depth test (for the light cap).
+//
+
+#version 430 compatibility
+
+layout(std430, binding = 0) readonly buffer WorldVerts { vec4 worldVerts[]; };
+
+uniform vec4 lightPos;      // World space.
+
+void main()
+{
+	vec4 v = worldVerts[gl_VertexID >> 2];
+	int kind = gl_VertexID & 3;
+
+	if (kind == 1)
+		v = vec4(lightPos.w * v.xyz - lightPos.xyz, 0.0);
+
+	gl_Position = gl_ModelViewProjectionMatrix * v;
+	gl_FrontColor = gl_Color;
+
+	if (kind == 2)
+		gl_Position.z = gl_Position.w;
+}
@@ -3,6 +3,34 @@
 #define _GLOBAL_H_
 
 
+/**
+ * Where shadow volumes are found: on the CPU, by a geometry shader or by a
+ * compute shader.
+ */
+enum VolumeMethod
+{
+	VOLUMES_CPU,
+	VOLUMES_GEOMETRY,
+	VOLUMES_COMPUTE,
+	VOLUME_METHOD_COUNT
+};
+
+
+/**
+ * Counts gathered while drawing a frame, for display.
+ */
+struct FrameStats
+{
+	int shadowVolumes;	// Caster and light pairs that could cast a shadow.
+	int culledVolumes;	// Of those, ones which couldn't be seen or lit.
+	int zPassVolumes;	// Volumes drawn with z-pass stencilling.
+	int zFailVolumes;	// Volumes drawn with z-fail, and their caps.
+	int silhouetteLoops;	// Loops in the silhouettes of the volumes drawn.
+	int savedIndexes;	// Fewer indexes sent than as separate triangles.
+	int proxyVolumes;	// Volumes drawn from a simplified shadow proxy.
+};
+
+
 /**
  * Global struct for holding control or state variables that can be read by
  * everything.
@@ -17,12 +45,18 @@ struct Global
 	
 	bool drawAmbientOnly;
 	
+	bool incrementalSilhouettes;
+	bool shadowProxies;
+	int volumeMethod;
+	
 	bool animate;
 	
 	int maxVisibleLights;
 	
 	int winWidth;
 	int winHeight;
+
+	FrameStats stats;
 };
 
 
@@ -2,7 +2,8 @@
 // shader.cpp
 //
 // Shader abstraction implementation. Contains function definitions for
-// VertexShader, FragmentShader and ShaderProgram classes.
+// VertexShader, GeometryShader, ComputeShader, FragmentShader and
+// ShaderProgram classes.
 //
 
 
@@ -113,6 +114,52 @@ VertexShader::VertexShader( const string &filename )
 }
 
 
+// ----------------------------------------------------------------------------
+// Geometry Shader class implementation
+// ----------------------------------------------------------------------------
+
+
+//
+// Constructor. Read geometry shader code from file and compile it.
+//
+GeometryShader::GeometryShader( const string &filename )
+  : Shader( filename )
+{
+  try
+  {
+    loadCode();
+    compile();
+  }
+  catch( std::runtime_error &err )
+  {
+    cerr << "Error: " << err.what () << endl;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Compute Shader class implementation
+// ----------------------------------------------------------------------------
+
+
+//
+// Constructor. Read compute shader code from file and compile it.
+//
+ComputeShader::ComputeShader( const string &filename )
+  : Shader( filename )
+{
+  try
+  {
+    loadCode();
+    compile();
+  }
+  catch( std::runtime_error &err )
+  {
+    cerr << "Error: " << err.what () << endl;
+  }
+}
+
+
 // ----------------------------------------------------------------------------
 // Fragment Shader class implementation
 // ----------------------------------------------------------------------------
@@ -181,9 +228,44 @@ ShaderProgram::ShaderProgram( const string &name,
 ShaderProgram::ShaderProgram( const string& name, const string &vShaderPath,
   const string &fShaderPath )
   : name( name ), linked( false ), id( 0 )
+{
+  load( vShaderPath, "", fShaderPath, "" );
+}
+
+
+//
+// As above, with a geometry shader between the vertex and fragment shaders.
+//
+ShaderProgram::ShaderProgram( const string& name, const string &vShaderPath,
+  const string &gShaderPath, const string &fShaderPath )
+  : name( name ), linked( false ), id( 0 )
+{
+  load( vShaderPath, gShaderPath, fShaderPath, "" );
+}
+
+
+//
+// A program made of a single compute shader.
+//
+ShaderProgram::ShaderProgram( const string& name, const string &cShaderPath )
+  : name( name ), linked( false ), id( 0 )
+{
+  load( "", "", "", cShaderPath );
+}
+
+
+//
+// Compiles and links the shaders in the given files. Any path can be left
+// empty to go without that shader.
+//
+void ShaderProgram::load( const string &vShaderPath,
+  const string &gShaderPath, const string &fShaderPath,
+  const string &cShaderPath )
 {
   VertexShader   *vShader = NULL;
+  GeometryShader *gShader = NULL;
   FragmentShader *fShader = NULL;
+  ComputeShader  *cShader = NULL;
 
   try
   {
@@ -193,17 +275,31 @@ ShaderProgram::ShaderProgram( const string& name, const string &vShaderPath,
       if( !vShader->isCompiled() )
         throw std::runtime_error( "Vertex Shader not compiled." );
     }
+    if( gShaderPath != "" )
+    {
+      gShader = new GeometryShader( gShaderPath );
+      if( !gShader->isCompiled() )
+        throw std::runtime_error( "Geometry Shader not compiled." );
+    }
     if( fShaderPath != "" )
     {
       fShader = new FragmentShader( fShaderPath );
       if( !fShader->isCompiled() )
         throw std::runtime_error( "Fragment Shader not compiled." );
     }
+    if( cShaderPath != "" )
+    {
+      cShader = new ComputeShader( cShaderPath );
+      if( !cShader->isCompiled() )
+        throw std::runtime_error( "Compute Shader not compiled." );
+    }
 
 
     id = glCreateProgram ();
     if( vShader ) glAttachShader( id, vShader->getId() );
+    if( gShader ) glAttachShader( id, gShader->getId() );
     if( fShader ) glAttachShader( id, fShader->getId() );
+    if( cShader ) glAttachShader( id, cShader->getId() );
 
     glLinkProgram( id );
     glGetProgramiv( id, GL_LINK_STATUS, &linked );
@@ -214,12 +310,16 @@ ShaderProgram::ShaderProgram( const string& name, const string &vShaderPath,
       throw std::runtime_error( "Link stage failed" );
 
     delete vShader;
+    delete gShader;
     delete fShader;
+    delete cShader;
   }
   catch( std::runtime_error &err )
   {
     if( vShader ) delete vShader;
+    if( gShader ) delete gShader;
     if( fShader ) delete fShader;
+    if( cShader ) delete cShader;
   
     cout << " failed!" << endl;
     cerr << "Error: " << err.what () << endl;
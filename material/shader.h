@@ -12,6 +12,15 @@
 #include <string>
 using std::string;
 
+// Geometry shaders are core in OpenGL 3.2 and compute shaders in 4.3, older
+// headers may not name them.
+#ifndef GL_GEOMETRY_SHADER
+#  define GL_GEOMETRY_SHADER 0x8DD9
+#endif
+#ifndef GL_COMPUTE_SHADER
+#  define GL_COMPUTE_SHADER 0x91B9
+#endif
+
 
 //
 // Shader base class. Is extended to a Vertex or Fragment shader below.
@@ -60,6 +69,38 @@ public:
 };
 
 
+//
+// Geometry Shader, extends the base Shader class above. Needs GLSL 1.50 or
+// later, so it won't compile on older drivers.
+//
+class GeometryShader : public Shader
+{
+
+public:
+
+  GeometryShader( const string &filename );
+
+  virtual GLenum getShaderType( void ) const { return GL_GEOMETRY_SHADER; }
+
+};
+
+
+//
+// Compute Shader, extends the base Shader class above. Needs GLSL 4.30 or
+// later.
+//
+class ComputeShader : public Shader
+{
+
+public:
+
+  ComputeShader( const string &filename );
+
+  virtual GLenum getShaderType( void ) const { return GL_COMPUTE_SHADER; }
+
+};
+
+
 //
 // Fragment Shader, extends the base Shader class above.
 //
@@ -88,12 +129,18 @@ private:
   GLint  linked;
   GLuint id;
 
+  void load( const string& vShaderPath, const string& gShaderPath,
+    const string& fShaderPath, const string& cShaderPath );
+
 public:
 
   ShaderProgram( const string& name, const VertexShader& vShader,
     const FragmentShader& fShader );
   ShaderProgram( const string& name, const string& vShaderPath,
     const string& fShaderPath );
+  ShaderProgram( const string& name, const string& vShaderPath,
+    const string& gShaderPath, const string& fShaderPath );
+  ShaderProgram( const string& name, const string& cShaderPath );
   ~ShaderProgram( void );
 
   void useProgram( void ) const;
@@ -0,0 +1,206 @@
+//
+// frustum.h
+//
+// The camera's view frustum in world space, kept as its eight corners and
+// six planes. Used to cull shadow volumes which can't reach anything that
+// is on screen, and to find which ones can use z-pass stencilling.
+//
+// Planes are stored in a Vec3 as the normal (x, y, z) and distance (w). A
+// point p is inside a plane when dot(normal, p) + w >= 0.
+//
+
+#ifndef _FRUSTUM_H_
+#define _FRUSTUM_H_
+
+
+#include "vec3.h"
+#include "matrix.h"
+
+
+// The most planes extendToLight() can give: six of the frustum's own and
+// one for each of its twelve edges.
+const int MAX_SHADOW_PLANES = 18;
+
+
+// The corners at either end of each edge of a Frustum, and the planes
+// either side of it.
+static const int FRUSTUM_EDGES[12][4] = {
+  { 0, 1, 0, 4 }, { 1, 2, 0, 3 }, { 2, 3, 0, 5 }, { 3, 0, 0, 2 },
+  { 4, 5, 1, 4 }, { 5, 6, 1, 3 }, { 6, 7, 1, 5 }, { 7, 4, 1, 2 },
+  { 0, 4, 2, 4 }, { 1, 5, 4, 3 }, { 2, 6, 3, 5 }, { 3, 7, 5, 2 }
+};
+
+
+//
+// Signed distance from a plane to a point, positive on the inside.
+//
+static float planeDistance (const Vec3& plane, const Vec3& p)
+{
+  return dot(plane, p) + plane.w;
+}
+
+
+class Frustum
+{
+
+private:
+
+  //
+  // The plane through three points, facing so that a point is inside it.
+  //
+  static Vec3 makePlane (const Vec3& a, const Vec3& b, const Vec3& c,
+      const Vec3& inside)
+  {
+    Vec3 n = crossProduct(b - a, c - a);
+    n.unitize();
+
+    Vec3 plane(n, -dot(n, a));
+    if (planeDistance(plane, inside) < 0)
+      plane = Vec3(-1.0f * n, dot(n, a));
+
+    return plane;
+  }
+
+  //
+  // As above, facing so that the middle of the frustum is inside.
+  //
+  Vec3 makePlane (const Vec3& a, const Vec3& b, const Vec3& c) const
+  { return makePlane(a, b, c, center); }
+
+public:
+
+  // Near corners then far corners, each bottom left, bottom right, top
+  // right, top left.
+  Vec3 corners[8];
+
+  // Near, far, left, right, bottom and top.
+  Vec3 planes[6];
+
+  Vec3 center;
+
+  //
+  // Builds the frustum of a perspective projection (as gluPerspective) for
+  // a camera looking down its -z axis.
+  //
+  void build (const Matrix& camToWorld, const float& fovY,
+      const float& aspect, const float& zNear, const float& zFar)
+  {
+    float t = tan(RAD(fovY) / 2.0f);
+
+    for (int i = 0; i < 2; i++)
+    {
+      float z = (i == 0) ? zNear : zFar;
+      float h = z * t;
+      float w = h * aspect;
+
+      corners[i * 4 + 0] = Vec3(-w, -h, -z);
+      corners[i * 4 + 1] = Vec3( w, -h, -z);
+      corners[i * 4 + 2] = Vec3( w,  h, -z);
+      corners[i * 4 + 3] = Vec3(-w,  h, -z);
+    }
+
+    center = Vec3(0.0f, 0.0f, 0.0f);
+    for (int i = 0; i < 8; i++)
+    {
+      camToWorld.transform(corners[i]);
+      center = center + 0.125f * corners[i];
+    }
+
+    planes[0] = makePlane(corners[0], corners[1], corners[2]);
+    planes[1] = makePlane(corners[4], corners[5], corners[6]);
+    planes[2] = makePlane(corners[0], corners[3], corners[7]);
+    planes[3] = makePlane(corners[1], corners[2], corners[6]);
+    planes[4] = makePlane(corners[0], corners[1], corners[5]);
+    planes[5] = makePlane(corners[3], corners[2], corners[6]);
+  }
+
+  //
+  // Finds the planes of the frustum stretched back to include a light, the
+  // smallest convex space in which a caster can throw a shadow onto
+  // something visible. Planes the light is inside of are kept, and the
+  // edges between those and the others are joined to the light. Returns
+  // the number of planes written to out, at most MAX_SHADOW_PLANES.
+  //
+  int extendToLight (const Vec3& lightPos, Vec3 *out) const
+  {
+    bool facing[6];
+    int count = 0;
+
+    for (int i = 0; i < 6; i++)
+    {
+      facing[i] = dot(planes[i], lightPos) + planes[i].w * lightPos.w >= 0;
+      if (facing[i])
+        out[count++] = planes[i];
+    }
+
+    for (int i = 0; i < 12; i++)
+    {
+      const int *edge = FRUSTUM_EDGES[i];
+      if (facing[edge[2]] == facing[edge[3]])
+        continue;
+
+      const Vec3& a = corners[edge[0]];
+      const Vec3& b = corners[edge[1]];
+
+      // Toward the light from a, for point and directional lights.
+      Vec3 toLight = lightPos - lightPos.w * a;
+      Vec3 n = crossProduct(b - a, toLight);
+
+      if (n.mag() > 0.0f)
+        out[count++] = makePlane(a, b, a + toLight);
+    }
+
+    return count;
+  }
+
+  //
+  // Finds the planes of the pyramid between the near clip rectangle and a
+  // light. Only a caster that is at least partly inside it can have its
+  // shadow volume cut by the near plane, any other can use z-pass. For a
+  // directional light it is a prism reaching back towards the light.
+  // Returns the number of planes written to out, or 0 if the light is too
+  // close to the near plane for the pyramid to be found.
+  //
+  int nearLightPyramid (const Vec3& lightPos, Vec3 *out) const
+  {
+    Vec3 nearCenter = 0.25f * (corners[0] + corners[1] + corners[2] +
+        corners[3]);
+    Vec3 toLight = lightPos - lightPos.w * nearCenter;
+
+    // A light in the near plane would give a flat pyramid.
+    if (fabs(dot(planes[0], toLight)) < 0.001f * toLight.mag())
+      return 0;
+
+    // Half way to the light, or one unit towards a directional one.
+    Vec3 inside = nearCenter + (lightPos.w != 0.0f ? 0.5f : 1.0f /
+        toLight.mag()) * toLight;
+
+    out[0] = makePlane(corners[0], corners[1], corners[2], inside);
+
+    for (int i = 0; i < 4; i++)
+    {
+      const Vec3& a = corners[i];
+      const Vec3& b = corners[(i + 1) % 4];
+      out[i + 1] = makePlane(a, b, a + (lightPos - lightPos.w * a), inside);
+    }
+
+    return 5;
+  }
+
+  //
+  // True unless a sphere is entirely outside one of a set of planes.
+  //
+  static bool sphereInside (const Vec3 *planes, const int& count,
+      const Vec3& center, const float& radius)
+  {
+    for (int i = 0; i < count; i++)
+      if (planeDistance(planes[i], center) < -radius)
+        return false;
+
+    return true;
+  }
+
+};
+
+
+#endif // _FRUSTUM_H_
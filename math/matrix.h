@@ -84,14 +84,17 @@ public:
 	
 	//
 	// Transforms a Vector by the current Matrix. Replaces the passed in Vector
-	// with a newly transformed Vec3.
+	// with a newly transformed Vec3. The translation is scaled by w, which is
+	// kept, so directions (and directional lights) with a w of 0 are only
+	// rotated.
 	//
 	void transform (Vec3& v) const
 	{
 		v = Vec3 (
-			(v.x * m11) + (v.y * m21) + (v.z * m31) + tx,
-			(v.x * m12) + (v.y * m22) + (v.z * m32) + ty,
-			(v.x * m13) + (v.y * m23) + (v.z * m33) + tz
+			(v.x * m11) + (v.y * m21) + (v.z * m31) + tx * v.w,
+			(v.x * m12) + (v.y * m22) + (v.z * m32) + ty * v.w,
+			(v.x * m13) + (v.y * m23) + (v.z * m33) + tz * v.w,
+			v.w
 	   );
 	}
   
@@ -7,10 +7,24 @@
 
 #include "caster.h"
 
+#include <algorithm>
+#include <cmath>
+#include <utility>
 
-// Used to fix silhouette calculations by providing a threshold for float
-// values to equal 0.
-const float ZERO_THRESHOLD = 0.0001f;
+using std::pair;
+using std::make_pair;
+
+
+// How near to the light a face's plane has to pass to be tested again when
+// the light moves, as a fraction of the model's radius (or of the direction's
+// length for directional lights). The light can move this far in total
+// before everything is searched again.
+static const float INCREMENTAL_RANGE = 0.05f;
+
+// A coarser shadow proxy is only switched to once its error is within this
+// fraction of the tolerance, so that a Caster sitting right at the limit
+// doesn't switch back and forth every frame.
+static const float PROXY_HYSTERESIS = 0.75f;
 
 
 //
@@ -33,54 +47,463 @@ const Matrix& Caster::getLocalToWorldMatrix (void)
 
 
 //
-// For each face in the model, finds whether the face is facing towards or away
-// from a light source. This function (like getSilhouette) assumes that the
-// light position is in local space not global.
+// Gives a sphere in world space which the Caster fits inside, around the
+// model's bounding box. It's grown by the error of the shadow proxy in use,
+// which can stick out of the model a little.
 //
-void Caster::findLightFacing(const Vec3& lightPos)
+void Caster::getBoundingSphere (Vec3& center, float& radius)
 {
-  for(vector<Face>::iterator it = model->faceArray.begin();
-      it != model->faceArray.end(); ++it)
+  if (dirtyBounds)
   {
-    it->lightFacing = dot(it->normal,
-        lightPos.w * model->vertArray[it->vStart] - lightPos) > ZERO_THRESHOLD;
+    Vec3 min, max;
+    model->findBoundingBox(min, max);
+
+    boundCenter = 0.5f * (min + max);
+    boundRadius = 0.5f * (max - min).mag();
+    dirtyBounds = false;
   }
+
+  center = boundCenter;
+  getLocalToWorldMatrix().transform(center);
+  radius = boundRadius;
+
+  if (proxyLevel > 0)
+    radius += model->shadowProxies[proxyLevel - 1].error;
 }
 
 
 //
-// Given a light source position, this function calculates a list of edges
-// which form the silhouette boundary between faces which faces towards the
-// light source, and faces that face away from the source.
+// The plane that the Caster's shadow volume is extruded out to for a light
+// with a radius, in local space. The normal points from the light towards
+// the Caster and w is the plane's distance from the light. Anything the
+// Caster shadows within the light's reach is nearer the light than the
+// plane, so the shortened volume still covers it. If the light has no
+// radius, or is inside the bounding sphere so that some rays from it never
+// meet the plane, w is 0 and volumes go out to infinity.
+//
+Vec3 Caster::findFarPlane (const Light& light, const Matrix& worldToLocal)
+{
+  Vec3 plane(0.0f, 0.0f, 0.0f, 0.0f);
+
+  if (!light.hasRange())
+    return plane;
+
+  Vec3 center;
+  float radius;
+  getBoundingSphere(center, radius);
+
+  Vec3 normal = center - light.getPosition();
+  float dist = normal.mag();
+
+  if (dist <= radius)
+    return plane;
+
+  // Rotate the normal into local space, distances don't change.
+  Vec3 a = light.getPosition();
+  Vec3 b = a + (1.0f / dist) * normal;
+  worldToLocal.transform(a);
+  worldToLocal.transform(b);
+
+  plane = b - a;
+  plane.w = std::max(light.radius, dist + radius);
+
+  return plane;
+}
+
+
+//
+// Makes room in the cache for a number of lights. getShadowCache() can be
+// called for different lights from several threads at once, but only after
+// this has been called on one of them.
+//
+void Caster::reserveShadows (const int& lights)
+{
+  if (lights > shadows.size())
+    shadows.resize(lights);
+}
+
+
+//
+// Picks the coarsest shadow proxy whose error would cover no more than
+// proxyTolerance pixels, given how many pixels one unit near the Caster
+// covers on screen. Proxies are in the same space as the model, so nothing
+// else changes. Returns true if a different proxy was picked, in which case
+// every shadow is found again from scratch: the edges and faces of the new
+// one don't match the old.
+//
+bool Caster::chooseShadowProxy (const float& pixelsPerUnit)
+{
+  int level = 0;
+
+  for (int i = 0; i < model->shadowProxies.size(); i++)
+  {
+    float limit = proxyTolerance;
+    if (i + 1 > proxyLevel)
+      limit *= PROXY_HYSTERESIS;
+
+    if (model->shadowProxies[i].error * pixelsPerUnit > limit)
+      break;
+
+    level = i + 1;
+  }
+
+  if (level == proxyLevel)
+    return false;
+
+  proxyLevel = level;
+
+  for (int i = 0; i < shadows.size(); i++)
+    shadows[i].valid = false;
+
+  return true;
+}
+
+
+//
+// The first edge in a list of (vertex, edge) pairs, sorted by vertex, which
+// is at the vertex and hasn't been used yet, or -1 if there isn't one.
+//
+static int findUnusedEdge (const vector< pair<int, int> >& edges,
+    const vector<bool>& used, const int& vertex)
+{
+  vector< pair<int, int> >::const_iterator i = std::lower_bound(
+      edges.begin(), edges.end(), make_pair(vertex, -1));
+
+  for (; i != edges.end() && i->first == vertex; ++i)
+  {
+    if (!used[i->second])
+      return i->second;
+  }
+
+  return -1;
+}
+
+
+//
+// Reorders a silhouette so that each edge is followed by the one starting
+// where it ends, and gives the number of edges in each of the loops that
+// makes. The silhouette of a closed mesh is only ever closed loops. An open
+// mesh's can also have chains which stop at its boundary, these are started
+// from their first edge so that each comes out in one piece. Where several
+// edges leave the same vertex any of them will do.
 //
-EdgeArray& Caster::getSilhouette(const Vec3& lightPos)
+static void chainSilhouette (EdgeArray& sil, vector<GLsizei>& loops)
 {
-  if (dirtySilhouette)
+  int count = sil.size();
+  vector< pair<int, int> > starts(count);
+  vector< pair<int, int> > ends(count);
+  vector<bool> used(count, false);
+
+  for (int i = 0; i < count; i++)
   {
-  	silhouette.clear();
+    starts[i] = make_pair(sil[i].v1, i);
+    ends[i] = make_pair(sil[i].v2, i);
+  }
 
-    findLightFacing(lightPos);
+  std::sort(starts.begin(), starts.end());
+  std::sort(ends.begin(), ends.end());
 
-    for(EdgeArray::iterator edge = model->edgeArray.begin();
-        edge != model->edgeArray.end(); ++edge)
+  EdgeArray chained;
+  chained.reserve(count);
+  loops.clear();
+
+  // Chains are started first, from edges which no other edge leads to.
+  for (int pass = 0; pass < 2; pass++)
+  {
+    for (int i = 0; i < count; i++)
     {
-	  	bool lf1 = (*edge).getFace(0).lightFacing;
-		  bool lf2 = (*edge).getFace(1).lightFacing;
+      if (used[i])
+        continue;
 
-      if ((lf1 && !lf2) || (!lf1 && lf2))
+      if (pass == 0)
       {
-        // Make sure that the edge is oriented properly.
-        if (lf1)
-          silhouette.push_back(*edge);
-        else
-          silhouette.push_back((*edge).reverse());
+        vector< pair<int, int> >::const_iterator previous = std::lower_bound(
+            ends.begin(), ends.end(), make_pair(sil[i].v1, -1));
+
+        if (previous != ends.end() && previous->first == sil[i].v1)
+          continue;
       }
+
+      int first = chained.size();
+
+      for (int edge = i; edge >= 0;
+          edge = findUnusedEdge(starts, used, sil[edge].v2))
+      {
+        used[edge] = true;
+        chained.push_back(sil[edge]);
+      }
+
+      loops.push_back(chained.size() - first);
     }
+  }
+
+  sil.swap(chained);
+}
 
-    dirtySilhouette = false;
+
+//
+// Builds the shadow volume from a shadow's silhouette and light facing
+// faces. The silhouette is chained into loops first, so that the sides of
+// each loop can be one triangle strip rather than two triangles per edge.
+// For point lights the strip runs between the loop and its extruded copy,
+// and the dark cap is a fan over the extruded loop. For directional lights
+// every vertex extrudes to the same point, so the sides are a fan around it
+// and there's no dark cap. The light cap is the light facing faces
+// themselves.
+//
+void Caster::buildVolume (const Vec3& lightPos, ShadowCache& shadow) const
+{
+  vector<GLuint>& volume = shadow.volume;
+  EdgeArray& sil = shadow.silhouette;
+  const Model *shadowModel = getShadowModel();
+  int offset = shadowModel->getRealVertexCount();
+
+  chainSilhouette(sil, shadow.sideCounts);
+
+  volume.clear();
+  shadow.capCounts.clear();
+  shadow.sideMode = (lightPos.w > 0) ? GL_TRIANGLE_STRIP : GL_TRIANGLE_FAN;
+
+  // The last vertex of a loop is its first again, unless it's an open chain.
+  int first = 0;
+
+  for (int i = 0; i < shadow.sideCounts.size(); i++)
+  {
+    int last = first + shadow.sideCounts[i];
+    int start = volume.size();
+
+    if (lightPos.w > 0)
+    {
+      for (int j = first; j < last; j++)
+      {
+        volume.push_back(sil[j].v1 + offset);
+        volume.push_back(sil[j].v1);
+      }
+
+      volume.push_back(sil[last - 1].v2 + offset);
+      volume.push_back(sil[last - 1].v2);
+    }
+    else
+    {
+      volume.push_back(offset);
+
+      for (int j = first; j < last; j++)
+        volume.push_back(sil[j].v1);
+
+      volume.push_back(sil[last - 1].v2);
+    }
+
+    shadow.sideCounts[i] = volume.size() - start;
+    first = last;
   }
 
-  return silhouette;
+  shadow.darkCapStart = volume.size();
+
+  if (lightPos.w > 0)
+  {
+    first = 0;
+
+    for (int i = 0; i < shadow.sideCounts.size(); i++)
+    {
+      int last = first + shadow.sideCounts[i] / 2 - 1;
+      int start = volume.size();
+
+      for (int j = first; j < last; j++)
+        volume.push_back(sil[j].v1 + offset);
+
+      if (sil[last - 1].v2 != sil[first].v1)
+        volume.push_back(sil[last - 1].v2 + offset);
+
+      // A loop of two edges covers no area.
+      if (volume.size() - start < 3)
+        volume.resize(start);
+      else
+        shadow.capCounts.push_back(volume.size() - start);
+
+      first = last;
+    }
+  }
+
+  shadow.lightCapStart = volume.size();
+
+  for (int i = 0; i < shadowModel->faceArray.size(); i++)
+  {
+    if (isLightFacing(shadow.lightFacing, i))
+    {
+      const Face& face = shadowModel->faceArray[i];
+      volume.push_back(face.index[0]);
+      volume.push_back(face.index[1]);
+      volume.push_back(face.index[2]);
+    }
+  }
+}
+
+
+//
+// Finds the light facing faces and silhouette edges of a shadow. When the
+// light has only moved a little since the last time, and incremental is
+// set, only the faces near the light are looked at again. Otherwise, or
+// once the light has moved too far in total, every face and edge is, but
+// the silhouette of a convex model is followed around from the last one
+// instead of testing its edges. Directional lights are looked up by their
+// direction, see DirectionalSilhouettes.
+//
+void Caster::findSilhouette (const Vec3& lightPos, ShadowCache& shadow,
+    const bool& incremental) const
+{
+  const SilhouetteData& data = getShadowModel()->silhouetteData;
+
+  // Directional lights only depend on their direction, and every Caster of
+  // the model shares the silhouettes found for them.
+  if (lightPos.w == 0.0f)
+  {
+    data.directional.lookup(data, lightPos, shadow.lightFacing,
+        shadow.silhouetteEdges);
+
+    shadow.moved = 0.0f;
+    shadow.nearRange = -1.0f;
+    return;
+  }
+
+  if (incremental && shadow.valid && shadow.lightPos.w == lightPos.w)
+  {
+    shadow.moved += (lightPos - shadow.lightPos).mag();
+
+    if (shadow.moved <= shadow.nearRange)
+    {
+      updateSilhouette(data, lightPos, shadow.moved, shadow.nearFaces,
+          shadow.lightFacing, shadow.silhouetteEdges, shadow.edgeSlots);
+      return;
+    }
+  }
+
+  // A convex model's silhouette is one loop, which can be followed around
+  // from an edge of the last one that is still on it.
+  if (data.convex && shadow.valid)
+  {
+    findLightFacing(data, lightPos, shadow.lightFacing);
+    shadow.previousEdges.swap(shadow.silhouetteEdges);
+
+    if (!walkConvexSilhouette(data, shadow.lightFacing, shadow.previousEdges,
+          shadow.silhouetteEdges))
+      findSilhouetteEdges(data, shadow.lightFacing, shadow.silhouetteEdges);
+  }
+  else
+  {
+    // A boundary edge has no second face, the missing face is treated as
+    // facing away so open meshes still produce a silhouette there. Only the
+    // clusters of faces the silhouette passes through are looked at
+    // closely.
+    findClusteredSilhouette(data, lightPos, shadow.lightFacing,
+        shadow.silhouetteEdges);
+  }
+
+  shadow.moved = 0.0f;
+
+  if (incremental)
+  {
+    if (lightPos.w != 0)
+      shadow.nearRange = INCREMENTAL_RANGE * data.radius * fabsf(lightPos.w);
+    else
+      shadow.nearRange = INCREMENTAL_RANGE * lightPos.mag();
+
+    findNearFaces(data, lightPos, shadow.nearRange, shadow.nearFaces);
+    findEdgeSlots(data, shadow.silhouetteEdges, shadow.edgeSlots);
+  }
+  else
+  {
+    // Never updated, so there's no need to keep the near faces.
+    shadow.nearRange = -1.0f;
+  }
+}
+
+
+//
+// True if the shadow for a light is already known for this local light
+// position, so getShadowCache() won't have to do any work.
+//
+bool Caster::hasShadow (const Vec3& lightPos, const int& light) const
+{
+  if (light >= shadows.size())
+    return false;
+
+  const ShadowCache& shadow = shadows[light];
+
+  return shadow.valid && shadow.lightPos.x == lightPos.x &&
+      shadow.lightPos.y == lightPos.y && shadow.lightPos.z == lightPos.z &&
+      shadow.lightPos.w == lightPos.w;
+}
+
+
+//
+// Returns the shadow state for a light, recalculating it first if the light
+// has moved relative to the Caster since it was last asked for. Moving
+// either the Caster or the light changes the local light position, so
+// there's nothing else to invalidate.
+//
+ShadowCache& Caster::getShadowCache(const Vec3& lightPos, const int& light,
+    const bool& incremental)
+{
+  if (hasShadow(lightPos, light))
+    return shadows[light];
+
+  if (light >= shadows.size())
+    shadows.resize(light + 1);
+
+  ShadowCache& shadow = shadows[light];
+
+  findSilhouette(lightPos, shadow, incremental);
+
+  shadow.silhouette.clear();
+  shadow.silhouette.reserve(shadow.silhouetteEdges.size());
+
+  EdgeArray& edges = getShadowModel()->edgeArray;
+
+  for (int i = 0; i < shadow.silhouetteEdges.size(); i++)
+  {
+    Edge& edge = edges[shadow.silhouetteEdges[i] >> 1];
+
+    // Make sure that the edge is oriented properly.
+    if (shadow.silhouetteEdges[i] & 1)
+      shadow.silhouette.push_back(edge.reverse());
+    else
+      shadow.silhouette.push_back(edge);
+  }
+
+  buildVolume(lightPos, shadow);
+
+  // Shadows are found on several threads at once.
+  static int lastVolumeId = 0;
+  shadow.volumeId = __sync_add_and_fetch(&lastVolumeId, 1);
+
+  shadow.lightPos = lightPos;
+  shadow.valid    = true;
+
+  return shadow;
+}
+
+
+//
+// Given a light source position, this function calculates a list of edges
+// which form the silhouette boundary between faces which faces towards the
+// light source, and faces that face away from the source. The light is also
+// identified by its index in the Scene, each light's silhouette is kept
+// until the light or the Caster moves.
+//
+EdgeArray& Caster::getSilhouette(const Vec3& lightPos, const int& light)
+{
+  return getShadowCache(lightPos, light).silhouette;
+}
+
+
+//
+// Returns a bitmask of the faces of the model which face the light, see
+// getSilhouette and isLightFacing.
+//
+const vector<uint>& Caster::getLightFacing(const Vec3& lightPos,
+    const int& light)
+{
+  return getShadowCache(lightPos, light).lightFacing;
 }
 
 
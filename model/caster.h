@@ -13,10 +13,64 @@
 
 
 #include "model.h"
+#include "light.h"
 #include "../math/vec3.h"
 #include "../math/matrix.h"
 
 
+// How far a Caster's shadow proxy can be from its real surface, in pixels on
+// screen, unless it is given its own tolerance. See chooseShadowProxy().
+static const float DEFAULT_PROXY_TOLERANCE = 1.0f;
+
+
+//
+// The shadow state of one Caster for one light: which faces are facing the
+// light, the silhouette they make and the shadow volume triangles. It is
+// only valid for the exact local light position it was found for, so it
+// survives for as long as neither the Caster nor the light moves. After a
+// small move it can be updated rather than found again, see
+// updateSilhouette().
+//
+struct ShadowCache
+{
+  Vec3 lightPos;                // Light position in local space.
+  bool valid;
+
+  vector<uint> lightFacing;     // One bit per face in the model.
+  vector<int> silhouetteEdges;  // See findSilhouetteEdges().
+  vector<int> previousEdges;    // The last ones, for convex models.
+  EdgeArray silhouette;
+
+  // Faces near the light at the last full search, how far the light has
+  // moved since, and where each edge is in silhouetteEdges.
+  vector<NearFace> nearFaces;
+  float nearRange;
+  float moved;
+  vector<int> edgeSlots;
+
+  // Shadow volume, as indexes into the shadow model's extrude buffer. The sides
+  // come first, one sideMode strip or fan for each loop of the silhouette,
+  // then the dark cap as one triangle fan per loop, then the light cap as
+  // separate triangles. See buildVolume().
+  vector<GLuint> volume;
+  vector<GLsizei> sideCounts;   // Indexes in each loop's sides.
+  vector<GLsizei> capCounts;    // Indexes in each dark cap fan.
+  GLenum sideMode;
+  int darkCapStart;
+  int lightCapStart;
+
+  // Different every time any volume is built, so that a copy of the volume
+  // elsewhere can tell if it's still current.
+  int volumeId;
+
+  ShadowCache (void)
+    : valid(false), nearRange(0.0f), moved(0.0f),
+      sideMode(GL_TRIANGLE_STRIP), darkCapStart(0), lightCapStart(0),
+      volumeId(0)
+  { }
+};
+
+
 class Caster
 {
   
@@ -30,22 +84,38 @@ private:
   Matrix localToWorld;
   bool dirtyMatrix;
 
+  // Bounding sphere of the model in local space, found when first needed.
+  Vec3 boundCenter;
+  float boundRadius;
+  bool dirtyBounds;
+
   bool caster;
 
-  void findLightFacing(const Vec3& lightPos);
-  EdgeArray silhouette;
-  bool dirtySilhouette;
+  // Which of the model's shadow proxies its shadows are found from, 0 for
+  // the model itself, and how far one may be from the model's surface in
+  // pixels on screen. See chooseShadowProxy().
+  int proxyLevel;
+  float proxyTolerance;
+
+  // Indexed by the light's position in the Scene.
+  vector<ShadowCache> shadows;
+
+  void findSilhouette (const Vec3& lightPos, ShadowCache& shadow,
+      const bool& incremental) const;
+  void buildVolume (const Vec3& lightPos, ShadowCache& shadow) const;
 
 public:
 
   Caster (Model *model, const Vec3& pos, const Vec3& rot)
     : model(model), pos(pos), rot(rot), dirtyMatrix(true),
-      caster(true), dirtySilhouette(true)
+      dirtyBounds(true), caster(true), proxyLevel(0),
+      proxyTolerance(DEFAULT_PROXY_TOLERANCE)
   { }
 
   Caster (Model *model, const Vec3& pos, const Vec3& rot, const bool& caster)
     : model(model), pos(pos), rot(rot), dirtyMatrix(true),
-      caster(caster), dirtySilhouette(true)
+      dirtyBounds(true), caster(caster), proxyLevel(0),
+      proxyTolerance(DEFAULT_PROXY_TOLERANCE)
   { }
 
   // Accessors.
@@ -55,6 +125,19 @@ public:
   const bool& isCaster (void) const
   { return caster; }
 
+  // The model or shadow proxy that shadows are found and drawn from.
+  Model *getShadowModel (void) const
+  {
+    return proxyLevel > 0 ?
+      model->shadowProxies[proxyLevel - 1].model : model;
+  }
+
+  const int& getProxyLevel (void) const
+  { return proxyLevel; }
+
+  const float& getProxyTolerance (void) const
+  { return proxyTolerance; }
+
   const Vec3& getTranslation (void) const
   { return pos; }
 
@@ -63,7 +146,18 @@ public:
 
   const Matrix& getLocalToWorldMatrix (void);
 
-  EdgeArray& getSilhouette (const Vec3& lightPos);
+  void getBoundingSphere (Vec3& center, float& radius);
+  Vec3 findFarPlane (const Light& light, const Matrix& worldToLocal);
+
+  bool hasShadow (const Vec3& lightPos, const int& light) const;
+  ShadowCache& getShadowCache (const Vec3& lightPos, const int& light,
+      const bool& incremental = true);
+  EdgeArray& getSilhouette (const Vec3& lightPos, const int& light);
+  const vector<uint>& getLightFacing (const Vec3& lightPos, const int& light);
+
+  void reserveShadows (const int& lights);
+
+  bool chooseShadowProxy (const float& pixelsPerUnit);
 
   // Mutators.
   void translate (const Vec3& pos);
@@ -75,8 +169,8 @@ public:
   void setCaster (const bool& caster)
   { this->caster = caster; }
 
-  void setDirtySilhouette (const bool& dirty)
-  { dirtySilhouette = dirty; }
+  void setProxyTolerance (const float& tolerance)
+  { proxyTolerance = tolerance; }
 };
 
 
@@ -9,7 +9,9 @@
 #include "../math/vec3.h"
 
 //
-//
+// A point or directional light. Point lights can be given a radius, they
+// fade out towards it and light nothing past it, see data/shaders/light.vert.
+// A radius of 0 means the light reaches everything.
 //
 class Light 
 {
@@ -18,17 +20,30 @@ public:
 
   Vec3 pos;
   Vec3 color;
+  float radius;
+
+  Light(const Vec3& pos) : pos(pos), color(1.0, 1.0, 1.0), radius(0.0f)
+  { }
 
-  Light(const Vec3& pos) : pos(pos), color(1.0, 1.0, 1.0)
+  Light(const Vec3& pos, const Vec3& color)
+    : pos(pos), color(color), radius(0.0f)
   { }
 
-  Light(const Vec3& pos, const Vec3& color) : pos(pos), color(color)
+  Light(const Vec3& pos, const Vec3& color, const float& radius)
+    : pos(pos), color(color), radius(radius)
   { }
 
   const Vec3& getPosition (void) const
   { return pos; }
+
+  // True if the light has a radius, directional lights never do.
+  bool hasRange (void) const
+  { return radius > 0.0f && pos.w != 0.0f; }
+
+  // True if any of a sphere is within reach of the light.
+  bool reaches (const Vec3& center, const float& r) const
+  { return !hasRange() || (center - pos).mag() < radius + r; }
 };
 
 
 #endif // _LIGHT_H_
-
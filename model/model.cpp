@@ -8,9 +8,54 @@
 
 
 #include "model.h"
+#include "simplify.h"
 #include "../material/texture.h"
 #include "../global.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+
+// Each shadow proxy has this fraction of the faces of the one before, down
+// to about MIN_PROXY_FACES and no more than MAX_SHADOW_PROXIES of them. See
+// buildShadowProxies().
+static const int PROXY_REDUCTION = 4;
+static const int MIN_PROXY_FACES = 64;
+static const int MAX_SHADOW_PROXIES = 3;
+
+
+//
+// Orders half edges by the vertex they lead to, ties are broken by their
+// position in the face array so edges keep the order the faces were loaded.
+//
+struct HalfEdgeLess
+{
+  const vector<int>& other;
+
+  HalfEdgeLess (const vector<int>& other)
+    : other(other)
+  { }
+
+  bool operator() (const int& a, const int& b) const
+  {
+    if (other[a] != other[b])
+      return other[a] < other[b];
+    return a < b;
+  }
+};
+
+
+//
+// Whether two corners of a face sit on the same real vertex. Such faces
+// have no area and are left out of the edges and shadow proxies.
+//
+static bool isDegenerate (const Face& face)
+{
+  return face.index[0] == face.index[1] || face.index[1] == face.index[2] ||
+    face.index[2] == face.index[0];
+}
+
 
 //
 // Returns a Vertex from the Model to which the edge belongs.
@@ -46,13 +91,48 @@ Model::~Model ()
     glDeleteBuffers(1, &vBuff);
     if (hasNormals)   glDeleteBuffers(1, &nBuff);
     if (hasTexCoords) glDeleteBuffers(1, &tBuff);
+    glDeleteBuffers(1, &iBuff);
+  }
+
+  if (usingShadowBuffers)
+  {
+    glDeleteBuffers(1, &eBuff);
+    glDeleteBuffers(1, &sBuff);
+    glDeleteBuffers(1, &planeBuff);
+    glDeleteBuffers(1, &sideBuff);
+    glDeleteTextures(1, &planeTex);
+    glDeleteTextures(1, &sideTex);
   }
 
+  clearShadowProxies();
+
   if (tex) delete tex;
 }
 
 
 
+//
+// Sets the values of the two referenced vectors to the min and max corners
+// of an axis aligned BoundingBox.
+//
+void Model::findBoundingBox(Vec3 &min, Vec3 &max) const
+{
+  min.x = min.y = min.z = FLT_MAX;
+  max.x = max.y = max.z = -FLT_MAX;
+
+  for(vector<Vec3>::const_iterator it = vertArray.begin();
+      it != vertArray.end(); ++it)
+  {
+    min.x = std::min(min.x, it->x);
+    min.y = std::min(min.y, it->y);
+    min.z = std::min(min.z, it->z);
+    max.x = std::max(max.x, it->x);
+    max.y = std::max(max.y, it->y);
+    max.z = std::max(max.z, it->z);
+  }
+}
+
+
 //
 // Loops through all faces in the current model and averages the faces normals.
 // Doesn't check normal array bounds, assumes that the model Object is valid.
@@ -62,15 +142,575 @@ void Model::calcFaceNormals (void)
   for(vector<Face>::iterator it = faceArray.begin();
       it != faceArray.end(); ++it)
   {
-    it->normal += normArray[it->vStart + 0];
-    it->normal += normArray[it->vStart + 1];
-    it->normal += normArray[it->vStart + 2];
+    it->normal += normArray[elemArray[it->vStart + 0]];
+    it->normal += normArray[elemArray[it->vStart + 1]];
+    it->normal += normArray[elemArray[it->vStart + 2]];
+
+    it->normal.unitize();
+  }
+}
+
+
+//
+// Works the face normals out from the positions of their corners instead,
+// for models without a normal array such as the shadow proxies.
+//
+void Model::calcPlaneNormals (void)
+{
+  for(vector<Face>::iterator it = faceArray.begin();
+      it != faceArray.end(); ++it)
+  {
+    const Vec3& a = realVerts[it->index[0]];
+    const Vec3& b = realVerts[it->index[1]];
+    const Vec3& c = realVerts[it->index[2]];
 
+    it->normal = crossProduct(a - b, b - c);
     it->normal.unitize();
   }
 }
 
 
+//
+// Orders faces by one coordinate of their centroids.
+//
+struct CentroidLess
+{
+  const vector<Vec3>& centroids;
+  int axis;
+
+  CentroidLess (const vector<Vec3>& centroids, const int& axis)
+    : centroids(centroids), axis(axis)
+  { }
+
+  bool operator() (const int& a, const int& b) const
+  { return centroids[a].v[axis] < centroids[b].v[axis]; }
+};
+
+
+//
+// Splits a range of faces at its median along the longest side of the box
+// around their centroids, and each half again until they are small enough
+// to be clusters. See splitFaceRange().
+//
+static void clusterFaceRange (const vector<Vec3>& centroids,
+    vector<int>& order, const int& begin, const int& end)
+{
+  if (end - begin <= CLUSTER_FACES)
+    return;
+
+  Vec3 min( FLT_MAX,  FLT_MAX,  FLT_MAX);
+  Vec3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+  for (int i = begin; i < end; i++)
+  {
+    const Vec3& c = centroids[order[i]];
+    min.x = std::min(min.x, c.x);  max.x = std::max(max.x, c.x);
+    min.y = std::min(min.y, c.y);  max.y = std::max(max.y, c.y);
+    min.z = std::min(min.z, c.z);  max.z = std::max(max.z, c.z);
+  }
+
+  Vec3 size = max - min;
+  int axis = 0;
+  if (size.y > size.x)
+    axis = 1;
+  if (size.z > size.x && size.z > size.y)
+    axis = 2;
+
+  int mid = splitFaceRange(begin, end);
+  std::nth_element(order.begin() + begin, order.begin() + mid,
+      order.begin() + end, CentroidLess(centroids, axis));
+
+  clusterFaceRange(centroids, order, begin, mid);
+  clusterFaceRange(centroids, order, mid, end);
+}
+
+
+//
+// Reorders the face array so that faces near each other end up next to each
+// other, in the ranges SilhouetteData groups into clusters. Must be called
+// before buildEdges(), while the face indexes are still free to change.
+// Face::vStart moves with each face, so drawing is unaffected.
+//
+void Model::clusterFaces (void)
+{
+  int count = faceArray.size();
+  int vCount = realVerts.size();
+
+  vector<Vec3> centroids(count);
+  vector<int> order(count);
+
+  for (int i = 0; i < count; i++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      int v = faceArray[i].index[k];
+      if (v >= 0 && v < vCount)
+        centroids[i] += realVerts[v];
+    }
+
+    centroids[i] = (1.0f / 3.0f) * centroids[i];
+    order[i] = i;
+  }
+
+  clusterFaceRange(centroids, order, 0, count);
+
+  vector<Face> sorted(count);
+  for (int i = 0; i < count; i++)
+    sorted[i] = faceArray[order[i]];
+
+  faceArray.swap(sorted);
+}
+
+
+//
+// Hashes the grid cell with the given coordinates into a table of tableSize
+// slots, a power of two.
+//
+static int hashCell (const int& x, const int& y, const int& z,
+    const int& tableSize)
+{
+  unsigned int h = (unsigned int) x * 73856093u ^
+                   (unsigned int) y * 19349663u ^
+                   (unsigned int) z * 83492791u;
+  return h & (tableSize - 1);
+}
+
+
+//
+// Merges real vertices which lie within tolerance of each other, so faces
+// split along a texture or normal seam share their edges again. Only the
+// shadow topology changes: the face indexes are moved onto the merged
+// vertices and realVerts is compacted, vertArray and the rest of the drawing
+// data are left alone. The edges must be built again afterwards with
+// buildEdges().
+//
+// Vertices are hashed into a grid of tolerance sized cells, so each one is
+// only compared with those in its own and the 26 neighbouring cells. A
+// vertex joins the first kept vertex in range rather than groups being
+// averaged, so a chain of close vertices can't drift. Returns the number of
+// vertices removed. Sliver faces with two corners welded together become
+// degenerate, they are counted in collapsed.
+//
+int Model::weldPositions (const float& tolerance, int& collapsed)
+{
+  int vCount = realVerts.size();
+  collapsed = 0;
+
+  if (tolerance <= 0.0f || vCount == 0)
+    return 0;
+
+  int tableSize = 1;
+  while (tableSize < vCount * 2)
+    tableSize <<= 1;
+
+  // Kept vertices are chained together by the table slot of their cell.
+  vector<int> head(tableSize, -1);
+  vector<int> next(vCount, -1);
+  vector<int> remap(vCount);
+
+  vector<Vec3> kept;
+  kept.reserve(vCount);
+
+  float range = tolerance * tolerance;
+
+  for (int v = 0; v < vCount; v++)
+  {
+    const Vec3& p = realVerts[v];
+
+    int cx = (int) floor(p.x / tolerance);
+    int cy = (int) floor(p.y / tolerance);
+    int cz = (int) floor(p.z / tolerance);
+
+    int found = -1;
+
+    for (int i = 0; i < 27 && found == -1; i++)
+    {
+      int slot = hashCell(cx + i % 3 - 1, cy + i / 3 % 3 - 1, cz + i / 9 - 1,
+          tableSize);
+
+      for (int k = head[slot]; k != -1 && found == -1; k = next[k])
+      {
+        Vec3 d = kept[k] - p;
+        if (dot(d, d) <= range)
+          found = k;
+      }
+    }
+
+    if (found == -1)
+    {
+      int slot = hashCell(cx, cy, cz, tableSize);
+
+      found = kept.size();
+      kept.push_back(p);
+      next[found] = head[slot];
+      head[slot] = found;
+    }
+
+    remap[v] = found;
+  }
+
+  for (vector<Face>::iterator it = faceArray.begin();
+      it != faceArray.end(); ++it)
+  {
+    bool wasDegenerate = isDegenerate(*it);
+
+    for (int k = 0; k < 3; k++)
+      if (it->index[k] >= 0 && it->index[k] < vCount)
+        it->index[k] = remap[it->index[k]];
+
+    if (!wasDegenerate && isDegenerate(*it))
+      collapsed++;
+  }
+
+  int removed = vCount - kept.size();
+  realVerts.swap(kept);
+
+  return removed;
+}
+
+
+//
+// Builds the edge array from the face array. Every face corner gives a half
+// edge, which is bucketed by the lower of its two vertex indexes and then
+// matched against the half edge running the other way inside that bucket.
+// Memory and time grow with the number of edges, not the square of the
+// vertex count.
+//
+// Edges come out in the same order and orientation as they always have: the
+// face whose half edge runs from the lower index to the higher one owns the
+// edge (f1), the face running the other way is f2. Half edges which can't be
+// paired still get an edge with f2 == -1, and are counted as boundary or
+// non-manifold edges. Degenerate faces are left out altogether, otherwise
+// their two remaining sides would pair up with each other and leave the
+// faces around them unmatched.
+//
+void Model::buildEdges (void)
+{
+  int hCount = faceArray.size() * 3;
+  int vCount = realVerts.size();
+
+  edgeArray.clear();
+  boundaryEdges    = 0;
+  nonManifoldEdges = 0;
+
+  // For each half edge, the vertex it starts from, the vertex it leads to
+  // and the half edge running the other way.
+  vector<int> from(hCount), other(hCount), mate(hCount, -1);
+  vector<int> bucketStart(vCount + 1, 0);
+
+  for (int h = 0; h < hCount; h++)
+  {
+    const Face& face = faceArray[h / 3];
+
+    from[h]  = face.index[h % 3];
+    other[h] = face.index[(h % 3 + 1) % 3];
+
+    // Half edges with bad indexes, or of degenerate faces, are left out of
+    // the edges altogether.
+    if (from[h] < 0 || other[h] < 0 || from[h] >= vCount ||
+        other[h] >= vCount || isDegenerate(face))
+    {
+      from[h] = other[h] = -1;
+      continue;
+    }
+
+    bucketStart[std::min(from[h], other[h]) + 1]++;
+  }
+
+  for (int v = 0; v < vCount; v++)
+    bucketStart[v + 1] += bucketStart[v];
+
+  // Counting sort the half edges into buckets by their lowest vertex.
+  vector<int> bucket(bucketStart[vCount]);
+  vector<int> cursor(bucketStart.begin(), bucketStart.end() - 1);
+
+  for (int h = 0; h < hCount; h++)
+    if (from[h] != -1)
+      bucket[cursor[std::min(from[h], other[h])]++] = h;
+
+  // Within a bucket, every half edge with the same higher vertex is part of
+  // the same edge. Forward half edges run low to high, and are paired off in
+  // order with the backward ones.
+  for (int v = 0; v < vCount; v++)
+  {
+    vector<int>::iterator begin = bucket.begin() + bucketStart[v];
+    vector<int>::iterator end   = bucket.begin() + bucketStart[v + 1];
+
+    for (vector<int>::iterator it = begin; it != end; ++it)
+      other[*it] = std::max(from[*it], other[*it]);
+
+    std::sort(begin, end, HalfEdgeLess(other));
+
+    while (begin != end)
+    {
+      vector<int>::iterator group = begin;
+      while (group != end && other[*group] == other[*begin])
+        ++group;
+
+      vector<int>::iterator fwd = begin, bwd = begin;
+      int size = group - begin;
+
+      for (;;)
+      {
+        while (fwd != group && from[*fwd] != v) ++fwd;
+        while (bwd != group && from[*bwd] == v) ++bwd;
+
+        if (fwd == group || bwd == group)
+          break;
+
+        mate[*fwd] = *bwd;
+        mate[*bwd] = *fwd;
+        ++fwd; ++bwd;
+      }
+
+      if (size == 1)
+        boundaryEdges++;
+      else if (size > 2 || mate[*begin] == -1)
+        nonManifoldEdges++;
+
+      begin = group;
+    }
+  }
+
+  // Emit the edges in half edge order. A paired edge is emitted by its
+  // forward half, an unpaired one by whichever half is left over.
+  for (int h = 0; h < hCount; h++)
+  {
+    int a = from[h];
+    int b = faceArray[h / 3].index[(h % 3 + 1) % 3];
+
+    if (a == -1)
+      continue;
+
+    if (a < b)
+    {
+      Edge e(a, b, h / 3, this);
+      if (mate[h] != -1)
+        e.addSecondFace(mate[h] / 3);
+      edgeArray.push_back(e);
+    }
+    else if (a > b && mate[h] == -1)
+    {
+      edgeArray.push_back(Edge(a, b, h / 3, this));
+    }
+  }
+}
+
+
+//
+// True if two vectors hold exactly the same components.
+//
+static inline bool sameVector (const Vec3& a, const Vec3& b)
+{
+  return a.x == b.x && a.y == b.y && a.z == b.z && a.w == b.w;
+}
+
+
+//
+// Collapses the per corner vertex, texture coordinate and normal arrays so
+// that every unique combination is only stored once, and fills elemArray
+// with three indexes per face. Face::vStart indexes elemArray from then on.
+//
+// Corners are bucketed by the real vertex they sit on, so only corners at
+// the same position are ever compared. Vertices are numbered in the order
+// they are first used by the faces.
+//
+void Model::indexVertices (void)
+{
+  int cCount = vertArray.size();
+  int vCount = realVerts.size();
+
+  // Unique vertices found so far for each real vertex, as the corner which
+  // first used them.
+  vector<int> bucketStart(vCount + 1, 0);
+  vector<int> bucketSize(vCount, 0);
+
+  for (vector<Face>::const_iterator it = faceArray.begin();
+      it != faceArray.end(); ++it)
+  {
+    for (int k = 0; k < 3; k++)
+      if (it->index[k] >= 0 && it->index[k] < vCount)
+        bucketStart[it->index[k] + 1]++;
+  }
+
+  for (int v = 0; v < vCount; v++)
+    bucketStart[v + 1] += bucketStart[v];
+
+  vector<int> bucket(bucketStart[vCount]);
+  vector<int> firstCorner;
+  firstCorner.reserve(cCount);
+
+  elemArray.resize(cCount);
+
+  for (vector<Face>::const_iterator it = faceArray.begin();
+      it != faceArray.end(); ++it)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      int c = it->vStart + k;
+      int v = it->index[k];
+      int found = -1;
+
+      if (v >= 0 && v < vCount)
+      {
+        for (int i = 0; i < bucketSize[v] && found == -1; i++)
+        {
+          int u = bucket[bucketStart[v] + i];
+          int d = firstCorner[u];
+
+          if (sameVector(vertArray[c], vertArray[d]) &&
+              (!hasTexCoords || sameVector(textArray[c], textArray[d])) &&
+              (!hasNormals || sameVector(normArray[c], normArray[d])))
+            found = u;
+        }
+      }
+
+      if (found == -1)
+      {
+        found = firstCorner.size();
+        firstCorner.push_back(c);
+
+        if (v >= 0 && v < vCount)
+          bucket[bucketStart[v] + bucketSize[v]++] = found;
+      }
+
+      elemArray[c] = found;
+    }
+  }
+
+  // Rebuild the arrays from the first corner of each unique vertex.
+  vector<Vec3> verts(firstCorner.size());
+  vector<Vec3> texts(hasTexCoords ? firstCorner.size() : 0);
+  vector<Vec3> norms(hasNormals ? firstCorner.size() : 0);
+
+  for (int u = 0; u < firstCorner.size(); u++)
+  {
+    verts[u] = vertArray[firstCorner[u]];
+    if (hasTexCoords) texts[u] = textArray[firstCorner[u]];
+    if (hasNormals)   norms[u] = normArray[firstCorner[u]];
+  }
+
+  vertArray.swap(verts);
+  textArray.swap(texts);
+  normArray.swap(norms);
+}
+
+//
+// The side of a face running between two vertexes, in either direction, or
+// -1 if the face has no such side.
+//
+static int findSide (const Face& face, const int& a, const int& b)
+{
+  for (int k = 0; k < 3; k++)
+  {
+    int u = face.index[k];
+    int v = face.index[(k + 1) % 3];
+
+    if ((u == a && v == b) || (u == b && v == a))
+      return k;
+  }
+
+  return -1;
+}
+
+
+//
+// Fills neighbours with four face indexes per face: the face across each of
+// its three sides, in the order of the side's first vertex, then a -1 to
+// pad it out to a texel. Sides without a face on the other side get -1,
+// which the volume shader treats as a face that never faces the light, so
+// a boundary edge is on the silhouette whenever its face is light facing,
+// just like the CPU silhouette.
+//
+void Model::buildNeighbours (vector<GLint>& neighbours) const
+{
+  neighbours.assign(faceArray.size() * 4, -1);
+
+  for (EdgeArray::const_iterator edge = edgeArray.begin();
+      edge != edgeArray.end(); ++edge)
+  {
+    if (edge->f2 == -1)
+      continue;
+
+    int ka = findSide(faceArray[edge->f1], edge->v1, edge->v2);
+    int kb = findSide(faceArray[edge->f2], edge->v1, edge->v2);
+
+    if (ka != -1 && kb != -1)
+    {
+      neighbours[edge->f1 * 4 + ka] = edge->f2;
+      neighbours[edge->f2 * 4 + kb] = edge->f1;
+    }
+  }
+}
+
+
+//
+// Makes the shadow proxies of a closed model, see simplifyMesh(), each
+// with about a quarter of the faces of the one before. Open or non-manifold
+// models, which edge collapse can't keep closed, and small models get none.
+// Must be called after buildEdges().
+//
+void Model::buildShadowProxies (void)
+{
+  clearShadowProxies();
+
+  if (boundaryEdges > 0 || nonManifoldEdges > 0)
+    return;
+
+  // Degenerate faces aren't part of the closed surface, see buildEdges().
+  vector<Face> surface;
+  surface.reserve(faceArray.size());
+  for (int f = 0; f < faceArray.size(); f++)
+    if (!isDegenerate(faceArray[f]))
+      surface.push_back(faceArray[f]);
+
+  vector<int> targets;
+  for (int faces = surface.size() / PROXY_REDUCTION;
+      faces >= MIN_PROXY_FACES && targets.size() < MAX_SHADOW_PROXIES;
+      faces /= PROXY_REDUCTION)
+    targets.push_back(faces);
+
+  vector<SimplifiedMesh> meshes;
+  simplifyMesh(realVerts, surface, targets, meshes);
+
+  for (int i = 0; i < meshes.size(); i++)
+  {
+    Model *proxy = new Model();
+    proxy->realVerts.swap(meshes[i].verts);
+    proxy->faceArray.swap(meshes[i].faces);
+
+    proxy->calcPlaneNormals();
+    proxy->clusterFaces();
+    proxy->buildEdges();
+
+    // Collapses never open the mesh up, but a proxy that did would cast the
+    // wrong shadows.
+    if (proxy->boundaryEdges > 0 || proxy->nonManifoldEdges > 0)
+    {
+      delete proxy;
+      break;
+    }
+
+    proxy->silhouetteData.build(*proxy);
+
+    ShadowProxy shadowProxy = { proxy, meshes[i].error };
+    shadowProxies.push_back(shadowProxy);
+  }
+}
+
+
+//
+// Deletes the shadow proxies.
+//
+void Model::clearShadowProxies (void)
+{
+  for (int i = 0; i < shadowProxies.size(); i++)
+    delete shadowProxies[i].model;
+
+  shadowProxies.clear();
+}
+
+
 //
 // Should be called after the model has been loaded if you wish to use a
 // VBO to draw the geometry. Since this assignment (and this class) is
@@ -81,23 +721,31 @@ void Model::initVertexBuffers()
 {
   usingVertexBuffers = true;
 
-  // Create a large array, first half the real vertices, the second a copy of
-  // the first with the w components set to 0.
-  vector<Vec3> allVertArray = realVerts;
-  for (int i = 0; i < realVerts.size(); ++i)
-    allVertArray.push_back(Vec3(realVerts[i], 0.0f));
-  
+  if (!tex && textureFile.size() > 0)
+  {
+    tex = new Texture();
+    tex->loadTexture(textureFile.c_str());
+  }
+
   // Vertex Array buffer.
   glGenBuffers(1, &vBuff);
   glBindBuffer(GL_ARRAY_BUFFER, vBuff);
   glBufferData(GL_ARRAY_BUFFER, sizeof(Vec3) * vertArray.size(),
       &(vertArray[0]), GL_STATIC_DRAW);
 
-  // Extrusion array buffer.
-  glGenBuffers(1, &eBuff);
-  glBindBuffer(GL_ARRAY_BUFFER, eBuff);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(Vec3) * allVertArray.size(),
-      &(allVertArray[0]), GL_STATIC_DRAW);
+  // Element array buffer.
+  glGenBuffers(1, &iBuff);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuff);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * elemArray.size(),
+      &(elemArray[0]), GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  // The buffers shadow volumes are drawn from, for this model and for each
+  // of its proxies.
+  initShadowBuffers();
+
+  for (int i = 0; i < shadowProxies.size(); i++)
+    shadowProxies[i].model->initShadowBuffers();
 
   // Normal array buffer.
   if (hasNormals)
@@ -119,6 +767,76 @@ void Model::initVertexBuffers()
 }
 
 
+//
+// Creates the buffers that shadow volumes are drawn from, see
+// bindExtrudeBuffer() and drawShadowFaces(). Only needs the real vertices,
+// faces and edges, so it works for shadow proxies too.
+//
+void Model::initShadowBuffers()
+{
+  usingShadowBuffers = true;
+
+  // Create a large array, first half the real vertices, the second a copy of
+  // the first with the w components set to 0.
+  vector<Vec3> allVertArray = realVerts;
+  for (int i = 0; i < realVerts.size(); ++i)
+    allVertArray.push_back(Vec3(realVerts[i], 0.0f));
+
+  // Extrusion array buffer.
+  glGenBuffers(1, &eBuff);
+  glBindBuffer(GL_ARRAY_BUFFER, eBuff);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(Vec3) * allVertArray.size(),
+      &(allVertArray[0]), GL_STATIC_DRAW);
+
+  // The faces by their real vertices, for finding shadow volumes on the
+  // GPU. The shader looks up each face's plane and neighbours by its index,
+  // so every face is tested against the light exactly once, with the same
+  // plane as the CPU silhouette.
+  vector<GLuint> faces(faceArray.size() * 3);
+  for (int f = 0; f < faceArray.size(); f++)
+    for (int k = 0; k < 3; k++)
+      faces[f * 3 + k] = faceArray[f].index[k];
+
+  glGenBuffers(1, &sBuff);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sBuff);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * faces.size(),
+      &(faces[0]), GL_STATIC_DRAW);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  vector<GLfloat> planes(faceArray.size() * 4);
+  for (int f = 0; f < faceArray.size(); f++)
+  {
+    planes[f * 4]     = silhouetteData.nx[f];
+    planes[f * 4 + 1] = silhouetteData.ny[f];
+    planes[f * 4 + 2] = silhouetteData.nz[f];
+    planes[f * 4 + 3] = silhouetteData.d[f];
+  }
+
+  vector<GLint> neighbours;
+  buildNeighbours(neighbours);
+
+  glGenBuffers(1, &planeBuff);
+  glBindBuffer(GL_TEXTURE_BUFFER, planeBuff);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(GLfloat) * planes.size(),
+      &(planes[0]), GL_STATIC_DRAW);
+
+  glGenBuffers(1, &sideBuff);
+  glBindBuffer(GL_TEXTURE_BUFFER, sideBuff);
+  glBufferData(GL_TEXTURE_BUFFER, sizeof(GLint) * neighbours.size(),
+      &(neighbours[0]), GL_STATIC_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  glGenTextures(1, &planeTex);
+  glBindTexture(GL_TEXTURE_BUFFER, planeTex);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, planeBuff);
+
+  glGenTextures(1, &sideTex);
+  glBindTexture(GL_TEXTURE_BUFFER, sideTex);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, sideBuff);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
+
+
 //
 // Call this function to draw the mesh from a VBO. Will throw an exception if
 // not initialised. This code should probably be in the renderer but it's a
@@ -153,7 +871,9 @@ void Model::drawVertexBuffers()
     tex->bindTexture();
   }
 
-  glDrawArrays(GL_TRIANGLES, 0, vertArray.size());
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, iBuff);
+  glDrawElements(GL_TRIANGLES, elemArray.size(), GL_UNSIGNED_INT, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
   // Disable pointers if the were activated.
   if (hasNormals)   glDisableClientState(GL_NORMAL_ARRAY);
@@ -167,8 +887,9 @@ void Model::drawVertexBuffers()
 
 
 //
-// Since a buffer cannot be legally bound inside of glBegin/glEnd, it needs
-// to be done prior in this function.
+// Binds the extrusion buffer as the vertex array. Shadow volumes are drawn
+// from it by index, the first half being the real vertices and the second
+// half their copies at infinity.
 //
 void Model::bindExtrudeBuffer ()
 {
@@ -179,38 +900,25 @@ void Model::bindExtrudeBuffer ()
 
 
 //
-// Will draw an indexed quad from the Vertex Buffers. Remember that this can
-// draw into the extruded values at twice the array length.
-//
-void Model::drawIndexQuad (const int& a, const int& b, const int& c,
-    const int& d)
-{
-  if (!usingVertexBuffers)
-    throw std::runtime_error("Attempt to draw uninitialised VBOs.");
-
-  //TODO: Error check that these are within bounds.
-  glBegin(GL_QUADS);
-    glArrayElement(a);
-    glArrayElement(b);
-    glArrayElement(c);
-    glArrayElement(d);
-  glEnd();
-}
-
-
-//
-// Same as above but only meant for a tri.
+// Draws every face from the extrusion buffer, which must already be bound,
+// for a geometry shader to build a shadow volume from. The face planes are
+// bound as a buffer texture on unit 0 and the faces across their sides on
+// unit 1, both indexed by gl_PrimitiveIDIn.
 //
-void Model::drawIndexTri (const int& a, const int& b, const int& c)
+void Model::drawShadowFaces ()
 {
-  if (!usingVertexBuffers)
-    throw std::runtime_error("Attempt to draw uninitialised VBOs.");
-
-  // TODO: Error check that these are within bounds.
-  glBegin(GL_TRIANGLES);
-    glArrayElement(a);
-    glArrayElement(b);
-    glArrayElement(c);
-  glEnd();
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_BUFFER, sideTex);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_BUFFER, planeTex);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sBuff);
+  glDrawElements(GL_TRIANGLES, faceArray.size() * 3, GL_UNSIGNED_INT, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+  glActiveTexture(GL_TEXTURE0);
 }
 
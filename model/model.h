@@ -13,12 +13,23 @@
 #define GL_GLEXT_PROTOTYPES
 #include <OpenGL/gl.h>
 #include <vector>
+#include <string>
 #include <stdexcept>
 
 #include "../math/vec3.h"
 #include "light.h"
+#include "silhouette.h"
 
 using std::vector;
+using std::string;
+
+// Buffer textures are core in OpenGL 3.1, older headers may not name them.
+#ifndef GL_TEXTURE_BUFFER
+#  define GL_TEXTURE_BUFFER 0x8C2A
+#endif
+#ifndef GL_RGBA32I
+#  define GL_RGBA32I 0x8D82
+#endif
 
 
 class Model; // Forward decleration for Edge.
@@ -32,15 +43,9 @@ class Texture;
 struct Face
 {
   int index[3];                 // Compact vertex representation.
-  int vStart;                   // First real vertex index.
-
-  bool lightFacing;
+  int vStart;                   // First of its three elemArray entries.
 
   Vec3 normal;
-
-  Face(void)
-    : lightFacing(false)
-  { }
 };
 
 
@@ -107,6 +112,17 @@ struct Edge
 typedef vector<Edge> EdgeArray;
 
 
+//
+// A simplified copy of a model which its shadows can be found from instead,
+// see Model::buildShadowProxies().
+//
+struct ShadowProxy
+{
+  Model *model;
+  float error;                  // How far it may be from the real surface.
+};
+
+
 //
 // The model class is specifically designed for finding shadow volumes and
 // possible silhouettes of the given mesh.
@@ -116,8 +132,14 @@ class Model
 
 private:
 
-  GLuint vBuff, nBuff, tBuff, eBuff;
+  GLuint vBuff, nBuff, tBuff, eBuff, iBuff, sBuff;
+  GLuint planeBuff, planeTex;   // Buffer textures of each face's plane and
+  GLuint sideBuff, sideTex;     // the faces across its sides, see
+                                // drawShadowFaces().
   bool usingVertexBuffers;
+  bool usingShadowBuffers;
+
+  void initShadowBuffers (void);
 
 public:
 
@@ -130,6 +152,11 @@ public:
   vector<Vec3> textArray;
   vector<Vec3> normArray;
 
+  // Indexes into the three arrays above, three per face. Each unique
+  // combination of position, texture coordinate and normal is only stored
+  // once, see indexVertices().
+  vector<GLuint> elemArray;
+
   // These sets are mostly used for shadow volume determination.
   vector<Face>  faceArray;
   EdgeArray edgeArray;
@@ -137,19 +164,38 @@ public:
   // A more compact version of the vertex positional array.
   vector<Vec3> realVerts;
 
+  // The faces and edges again, laid out for the silhouette kernels. Built
+  // once the model is loaded.
+  SilhouetteData silhouetteData;
+
+  // Simplified copies of a closed model for casting its shadows, each with
+  // about a quarter of the faces of the one before. They only have positions,
+  // faces, edges and silhouette data.
+  vector<ShadowProxy> shadowProxies;
+
   // Just for efficientcy.
   bool hasNormals;
   bool hasTexCoords;
 
+  // Topology problems found by buildEdges(). Boundary edges only have one
+  // face (f2 == -1), non-manifold edges are shared by more than two faces or
+  // by two faces with the same winding.
+  int boundaryEdges;
+  int nonManifoldEdges;
+
+  // The texture is only loaded from textureFile by initVertexBuffers(), so
+  // that loading the rest of a model doesn't need a GL context.
   Texture *tex;
+  string textureFile;
 
   // ------------------------------------------------------------------------
   // Interface
   // ------------------------------------------------------------------------
 
   Model(void)
-    : usingVertexBuffers(false), hasNormals(false), hasTexCoords(false),
-    tex(NULL)
+    : usingVertexBuffers(false), usingShadowBuffers(false),
+    hasNormals(false), hasTexCoords(false),
+    boundaryEdges(0), nonManifoldEdges(0), tex(NULL)
   { }
 
   ~Model(void);
@@ -175,6 +221,12 @@ public:
   const GLfloat *getTexCoordPointer(void) const
   { return (GLfloat *) &(textArray[0]); }
 
+  const GLuint *getElementPointer(void) const
+  { return &(elemArray[0]); }
+
+  const int getElementCount(void) const
+  { return elemArray.size(); }
+
   const int faceCount( void ) const
   { return faceArray.size(); }
 
@@ -190,8 +242,26 @@ public:
   EdgeArray& getEdgeArray()
   { return edgeArray; }
 
+  void findBoundingBox(Vec3 &min, Vec3 &max) const;
+
   void calcFaceNormals(void);
 
+  void calcPlaneNormals(void);
+
+  void clusterFaces(void);
+
+  int weldPositions(const float& tolerance, int& collapsed);
+
+  void buildEdges(void);
+
+  void indexVertices(void);
+
+  void buildNeighbours(vector<GLint>& neighbours) const;
+
+  void buildShadowProxies(void);
+
+  void clearShadowProxies(void);
+
   // ------------------------------------------------------------------------
   // Drawing interface.
   // ------------------------------------------------------------------------
@@ -201,9 +271,7 @@ public:
 
   void bindExtrudeBuffer (void);
 
-  // Used for drawing shadow volumes.
-  void drawIndexQuad (const int& a, const int& b, const int& c, const int& d);
-  void drawIndexTri  (const int& a, const int& b, const int& c);
+  void drawShadowFaces (void);
 };
 
 
@@ -38,16 +38,6 @@ public:
 	{
 		casters.push_back(caster);
 	}
-
-  //
-  // Sets all the silhouettes to dirty, meaning they'll be recalculated
-  // next time they're requested.
-  //
-  void dirtyAllCasters()
-  {
-    for (int i = 0; i < casters.size(); ++i)
-      casters[i].setDirtySilhouette(true);
-  }
 };
 
 
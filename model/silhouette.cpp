@@ -0,0 +1,1333 @@
+//
+// silhouette.cpp
+//
+// Light facing and silhouette kernels. Each comes in a plain C++ version,
+// and on x86 in SSE and AVX2 versions which are chosen between at run time
+// depending on what the CPU supports. All versions give identical results.
+//
+// A face faces the light at (L, w) when
+//
+//   w * dot(N, V) - dot(N, L) > ZERO_THRESHOLD
+//
+// which is dot(N, w * V - L) with dot(N, V) worked out once at load time.
+//
+// For a cluster of faces, w * V - L is within |w| * radius of w * C - L (C
+// being the middle of its sphere), and N within the cone around its axis,
+// which bounds the test for every face in it at once.
+//
+
+
+#include "silhouette.h"
+#include "model.h"
+
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+    __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#  define SILHOUETTE_X86
+#  include <immintrin.h>
+#endif
+
+
+const float ZERO_THRESHOLD = 0.0001f;
+
+
+// Arrays are padded to a multiple of the widest kernel.
+static const int SIMD_WIDTH = 8;
+
+// Bins along each side of the octahedral map of directional light
+// directions, each about 1.4 degrees across.
+static const int DIRECTION_BINS = 128;
+
+// Once this many directions are kept for a model they are all thrown away.
+static const int MAX_DIRECTIONS = 256;
+
+// A cluster is only settled when its bounds clear the threshold by this much
+// of the size of the numbers involved, so rounding in the kernels can never
+// put one of its faces on the other side.
+static const float CLUSTER_SLACK = 1e-5f;
+
+// Below this many faces it's quicker to test every face and edge than to
+// go through the clusters, so no tree is built.
+static const int MIN_CLUSTERED_FACES = 32768;
+
+// Neighbouring faces are taken to be in the same plane when their normals
+// and vertices are this close to it, as a fraction of the model's radius
+// for the vertices.
+static const float COPLANAR_SLACK = 1e-6f;
+
+// How far a face's corners can be in front of a neighbour's plane in a
+// convex model, as a fraction of the model's radius.
+static const float CONVEX_SLACK = 1e-5f;
+
+// Below this many faces testing every edge is as quick as following the
+// silhouette of a convex model around.
+static const int MIN_WALKED_FACES = 16384;
+
+// Clustered edges are tested this many at a time, see testEdges().
+static const int EDGE_CHUNK = 256;
+
+// Which side of a light a cluster is on, see classifyCluster().
+enum ClusterSide
+{
+  CLUSTER_BACK,
+  CLUSTER_FRONT,
+  CLUSTER_MIXED
+};
+
+
+static SilhouetteSimd detectSimd (void)
+{
+#ifdef SILHOUETTE_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return SIMD_SSE;
+#endif
+  return SIMD_NONE;
+}
+
+
+static const SilhouetteSimd bestSimd = detectSimd();
+static SilhouetteSimd currentSimd = bestSimd;
+
+
+//
+// Copies the face planes and edge faces out of a model. Needs to be called
+// again whenever the model's faces or edges change.
+//
+void SilhouetteData::build (const Model& model)
+{
+  directional.clear();
+
+  faceCount = model.faceArray.size();
+  edgeCount = model.edgeArray.size();
+
+  // There is always at least one padding face, for edges with only one face
+  // to point at.
+  int faces = (faceCount / SIMD_WIDTH + 1) * SIMD_WIDTH;
+  int edges = (edgeCount + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+
+  nx.assign(faces, 0.0f);
+  ny.assign(faces, 0.0f);
+  nz.assign(faces, 0.0f);
+  d.assign(faces, 0.0f);
+
+  for (int i = 0; i < faceCount; i++)
+  {
+    const Face& face = model.faceArray[i];
+    const Vec3& v = model.realVerts[face.index[0]];
+
+    nx[i] = face.normal.x;
+    ny[i] = face.normal.y;
+    nz[i] = face.normal.z;
+    d[i]  = face.normal.x * v.x + face.normal.y * v.y + face.normal.z * v.z;
+  }
+
+  f1.assign(edges, faceCount);
+  f2.assign(edges, faceCount);
+
+  // Every face corner gives at most one edge, so three slots are enough
+  // even on non-manifold meshes.
+  faceEdges.assign(faceCount * 3, -1);
+
+  for (int i = 0; i < edgeCount; i++)
+  {
+    const Edge& edge = model.edgeArray[i];
+
+    f1[i] = edge.f1;
+    if (edge.f2 != -1)
+      f2[i] = edge.f2;
+
+    addFaceEdge(edge.f1, i);
+    if (edge.f2 != -1)
+      addFaceEdge(edge.f2, i);
+  }
+
+  radius = 0.0f;
+  for (int i = 0; i < model.realVerts.size(); i++)
+    radius = std::max(radius, model.realVerts[i].mag());
+
+  // Uses faceEdges to find neighbours, which is then cut down to just the
+  // candidate edges.
+  groupCoplanarFaces(model);
+  findConvex(model);
+  findCandidateEdges(model);
+
+  buildClusters(model);
+}
+
+
+void SilhouetteData::addFaceEdge (const int& face, const int& edge)
+{
+  for (int j = face * 3; j < face * 3 + 3; j++)
+  {
+    if (faceEdges[j] == -1)
+    {
+      faceEdges[j] = edge;
+      return;
+    }
+  }
+}
+
+
+//
+// True if a face lies in the plane of another, to within COPLANAR_SLACK.
+//
+static bool inPlaneOf (const Model& model, const int& face, const int& other,
+    const float& tolerance)
+{
+  const Face& plane = model.faceArray[other];
+  const Face& test  = model.faceArray[face];
+
+  if (dot(plane.normal, test.normal) < 1.0f - COPLANAR_SLACK)
+    return false;
+
+  float d = dot(plane.normal, model.realVerts[plane.index[0]]);
+
+  for (int k = 0; k < 3; k++)
+  {
+    if (fabsf(dot(plane.normal, model.realVerts[test.index[k]]) - d) >
+        tolerance)
+      return false;
+  }
+
+  return true;
+}
+
+
+//
+// Gathers faces into groups of neighbours which lie in the same plane, and
+// gives every face of a group the plane of the first one found. Faces with
+// exactly the same plane always get the same answer from the facing test,
+// whichever kernel does it, so the edges between them can never be on the
+// silhouette. Faces are only compared with the first of their group, so a
+// gently curved surface doesn't get flattened out a little at a time.
+//
+void SilhouetteData::groupCoplanarFaces (const Model& model)
+{
+  float tolerance = COPLANAR_SLACK * std::max(radius, 1.0f);
+  vector<bool> grouped(faceCount, false);
+  vector<int> stack;
+
+  for (int first = 0; first < faceCount; first++)
+  {
+    if (grouped[first])
+      continue;
+
+    grouped[first] = true;
+
+    // Faces without a proper normal never face the light anyway.
+    if (fabsf(model.faceArray[first].normal.mag() - 1.0f) >= 1e-4f)
+      continue;
+
+    stack.push_back(first);
+
+    while (!stack.empty())
+    {
+      int face = stack.back();
+      stack.pop_back();
+
+      for (int j = face * 3; j < face * 3 + 3 && faceEdges[j] != -1; j++)
+      {
+        int e = faceEdges[j];
+        int other = (f1[e] == face) ? f2[e] : f1[e];
+
+        if (other >= faceCount || grouped[other] ||
+            !inPlaneOf(model, other, first, tolerance))
+          continue;
+
+        grouped[other] = true;
+        nx[other] = nx[first];
+        ny[other] = ny[first];
+        nz[other] = nz[first];
+        d[other]  = d[first];
+
+        stack.push_back(other);
+      }
+    }
+  }
+}
+
+
+//
+// Lists the edges which can be on a silhouette, leaving out those between
+// two faces with exactly the same plane. Edges with only one face are
+// always kept. faceEdges is rebuilt with only the kept edges, so that
+// updateSilhouette() never looks at the others either.
+//
+void SilhouetteData::findCandidateEdges (const Model& model)
+{
+  candidateEdges.clear();
+  candidateF1.clear();
+  candidateF2.clear();
+  faceEdges.assign(faceCount * 3, -1);
+
+  for (int i = 0; i < edgeCount; i++)
+  {
+    int a = f1[i];
+    int b = f2[i];
+
+    if (model.edgeArray[i].f2 != -1 && nx[a] == nx[b] && ny[a] == ny[b] &&
+        nz[a] == nz[b] && d[a] == d[b])
+      continue;
+
+    candidateEdges.push_back(i);
+    candidateF1.push_back(a);
+    candidateF2.push_back(b);
+
+    addFaceEdge(a, i);
+    if (model.edgeArray[i].f2 != -1)
+      addFaceEdge(b, i);
+  }
+}
+
+
+//
+// Decides whether the model is convex: closed, in one piece, and with no
+// corner of any face in front of the plane of a neighbouring face. The
+// faces a light outside it can see are then one patch, with one loop of
+// edges around it. Needs the full faceEdges, which is kept for convex
+// models along with the vertices of each edge, for walkConvexSilhouette().
+//
+void SilhouetteData::findConvex (const Model& model)
+{
+  convex = false;
+  edgeVerts.clear();
+  allFaceEdges.clear();
+
+  if (faceCount == 0 || edgeCount * 2 != faceCount * 3)
+    return;
+
+  for (int i = 0; i < faceCount; i++)
+  {
+    if (fabsf(model.faceArray[i].normal.mag() - 1.0f) >= 1e-4f)
+      return;
+  }
+
+  float tolerance = CONVEX_SLACK * std::max(radius, 1.0f);
+
+  for (int i = 0; i < edgeCount; i++)
+  {
+    const Edge& edge = model.edgeArray[i];
+
+    if (edge.f2 == -1)
+      return;
+
+    for (int k = 0; k < 2; k++)
+    {
+      const Face& face = model.faceArray[k ? edge.f2 : edge.f1];
+      int plane = k ? edge.f1 : edge.f2;
+
+      for (int c = 0; c < 3; c++)
+      {
+        const Vec3& v = model.realVerts[face.index[c]];
+
+        if (nx[plane] * v.x + ny[plane] * v.y + nz[plane] * v.z - d[plane] >
+            tolerance)
+          return;
+      }
+    }
+  }
+
+  // Two convex pieces side by side pass every test above.
+  vector<bool> reached(faceCount, false);
+  vector<int> stack(1, 0);
+  int count = 1;
+  reached[0] = true;
+
+  while (!stack.empty())
+  {
+    int face = stack.back();
+    stack.pop_back();
+
+    for (int j = face * 3; j < face * 3 + 3 && faceEdges[j] != -1; j++)
+    {
+      int e = faceEdges[j];
+      int other = (f1[e] == face) ? f2[e] : f1[e];
+
+      if (!reached[other])
+      {
+        reached[other] = true;
+        stack.push_back(other);
+        count++;
+      }
+    }
+  }
+
+  convex = count == faceCount;
+
+  if (!convex)
+    return;
+
+  allFaceEdges = faceEdges;
+  edgeVerts.resize(edgeCount * 2);
+
+  for (int i = 0; i < edgeCount; i++)
+  {
+    edgeVerts[i * 2]     = model.edgeArray[i].v1;
+    edgeVerts[i * 2 + 1] = model.edgeArray[i].v2;
+  }
+}
+
+
+//
+// Where a range of faces is split into two clusters. Ranges start on a
+// multiple of 32, and so does the second half, so every cluster covers whole
+// words of a face bitmask. Model::clusterFaces() sorts the faces into the
+// same ranges.
+//
+int splitFaceRange (const int& begin, const int& end)
+{
+  return begin + ((end - begin) / 2 + 31) / 32 * 32;
+}
+
+
+//
+// Adds the cluster for a range of faces, and its children if it has too
+// many faces, returning its index.
+//
+int SilhouetteData::addCluster (const Model& model, const int& begin,
+    const int& end)
+{
+  FaceCluster cluster;
+  cluster.faceBegin = begin;
+  cluster.faceEnd   = end;
+  cluster.edgeBegin = cluster.edgeEnd = 0;
+  cluster.second    = -1;
+
+  Vec3 min( FLT_MAX,  FLT_MAX,  FLT_MAX);
+  Vec3 max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+  Vec3 sum(0.0f, 0.0f, 0.0f);
+  bool unit = true;
+
+  for (int i = begin; i < end; i++)
+  {
+    const Face& face = model.faceArray[i];
+
+    for (int k = 0; k < 3; k++)
+    {
+      const Vec3& v = model.realVerts[face.index[k]];
+      min.x = std::min(min.x, v.x);  max.x = std::max(max.x, v.x);
+      min.y = std::min(min.y, v.y);  max.y = std::max(max.y, v.y);
+      min.z = std::min(min.z, v.z);  max.z = std::max(max.z, v.z);
+    }
+
+    sum += face.normal;
+    unit = unit && fabsf(face.normal.mag() - 1.0f) < 1e-4f;
+  }
+
+  cluster.center = 0.5f * (min + max);
+  cluster.radius = 0.0f;
+
+  for (int i = begin; i < end; i++)
+  {
+    const Face& face = model.faceArray[i];
+    for (int k = 0; k < 3; k++)
+      cluster.radius = std::max(cluster.radius,
+          (model.realVerts[face.index[k]] - cluster.center).mag());
+  }
+  cluster.radius *= 1.0f + CLUSTER_SLACK;
+
+  // Faces without a proper normal never face the light, so a cluster with
+  // any can't be all light facing. Giving it a full cone makes sure.
+  cluster.axis = Vec3(0.0f, 0.0f, 1.0f);
+  cluster.cosCone = -1.0f;
+  cluster.sinCone = 0.0f;
+
+  if (unit && sum.mag() > 1e-3f * (end - begin))
+  {
+    cluster.axis = sum;
+    cluster.axis.unitize();
+
+    float minDot = 1.0f;
+    for (int i = begin; i < end; i++)
+      minDot = std::min(minDot, dot(cluster.axis, model.faceArray[i].normal));
+
+    // The cone is opened a little past any rounding in the dots.
+    cluster.cosCone = std::max(minDot - CLUSTER_SLACK, -1.0f);
+    cluster.sinCone = sqrtf(1.0f - cluster.cosCone * cluster.cosCone);
+  }
+
+  int index = clusters.size();
+  clusters.push_back(cluster);
+
+  if (end - begin > CLUSTER_FACES)
+  {
+    int mid = splitFaceRange(begin, end);
+    addCluster(model, begin, mid);
+    clusters[index].second = addCluster(model, mid, end);
+  }
+
+  return index;
+}
+
+
+//
+// Builds the cluster tree over the (already sorted) faces, and files every
+// candidate edge under the smallest cluster holding both its faces. Edges of a
+// cluster which faces the light entirely, or not at all, can't be on the
+// silhouette. Edges with only one face are kept apart, they are on the
+// silhouette whenever their face is light facing.
+//
+void SilhouetteData::buildClusters (const Model& model)
+{
+  clusters.clear();
+  clusterEdges.clear();
+  clusterF1.clear();
+  clusterF2.clear();
+  openEdgeBegin = 0;
+
+  if (faceCount < MIN_CLUSTERED_FACES)
+    return;
+
+  addCluster(model, 0, faceCount);
+
+  // Open edges go after every cluster's edges.
+  int open = clusters.size();
+  int count = candidateEdges.size();
+  vector<int> owner(count);
+  vector<int> start(open + 2, 0);
+
+  for (int i = 0; i < count; i++)
+  {
+    const Edge& edge = model.edgeArray[candidateEdges[i]];
+    int node = 0;
+
+    if (edge.f2 == -1)
+      node = open;
+
+    while (node != open && clusters[node].second != -1)
+    {
+      int mid = clusters[node + 1].faceEnd;
+      bool low1 = edge.f1 < mid;
+      bool low2 = edge.f2 < mid;
+
+      if (low1 != low2)
+        break;
+
+      node = low1 ? node + 1 : clusters[node].second;
+    }
+
+    owner[i] = node;
+    start[node + 1]++;
+  }
+
+  for (int i = 0; i <= open; i++)
+    start[i + 1] += start[i];
+
+  for (int i = 0; i < open; i++)
+    clusters[i].edgeBegin = clusters[i].edgeEnd = start[i];
+  openEdgeBegin = start[open];
+
+  clusterEdges.resize(count);
+  clusterF1.resize(count);
+  clusterF2.resize(count);
+
+  for (int i = 0; i < count; i++)
+  {
+    int j = (owner[i] == open) ? start[open]++ : clusters[owner[i]].edgeEnd++;
+    clusterEdges[j] = candidateEdges[i];
+    clusterF1[j] = candidateF1[i];
+    clusterF2[j] = candidateF2[i];
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// Plain versions.
+// ----------------------------------------------------------------------------
+
+
+//
+// The light facing kernels only look at faces [begin, end), both of which
+// have to be multiples of 8. The bits for other faces are left alone.
+//
+static void findLightFacingPlain (const SilhouetteData& data,
+    const Vec3& l, const int& begin, const int& end, uint *facing)
+{
+  for (int i = begin; i < end; i++)
+  {
+    float nl = data.nx[i] * l.x + data.ny[i] * l.y + data.nz[i] * l.z;
+
+    if (l.w * data.d[i] - nl > ZERO_THRESHOLD)
+      facing[i >> 5] |= 1u << (i & 31);
+  }
+}
+
+
+//
+// Tests a list of edges against a light facing bitmask, with the faces
+// either side of each given alongside it. Edges are written out as (index
+// * 2 + reversed), reversed being set when the edge has to be flipped to
+// keep the light facing face on its left. There's no branch on whether an
+// edge is kept, the output is just advanced past it or not.
+//
+static int testEdgeListPlain (const int *list, const int *f1s,
+    const int *f2s, const int& count, const uint *facing, int *out)
+{
+  int n = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    int f1 = f1s[i];
+    int f2 = f2s[i];
+    uint a = (facing[f1 >> 5] >> (f1 & 31)) & 1;
+    uint b = (facing[f2 >> 5] >> (f2 & 31)) & 1;
+
+    out[n] = list[i] * 2 + a;
+    n += a ^ b;
+  }
+
+  return n;
+}
+
+
+#ifdef SILHOUETTE_X86
+
+// ----------------------------------------------------------------------------
+// SSE versions. The face bitmask is written a byte (8 faces) at a time, which
+// relies on x86 being little endian. Edges use the plain version.
+// ----------------------------------------------------------------------------
+
+
+__attribute__((target("sse2")))
+static void findLightFacingSSE (const SilhouetteData& data, const Vec3& l,
+    const int& begin, const int& end, uint *facing)
+{
+  const __m128 lx  = _mm_set1_ps(l.x);
+  const __m128 ly  = _mm_set1_ps(l.y);
+  const __m128 lz  = _mm_set1_ps(l.z);
+  const __m128 lw  = _mm_set1_ps(l.w);
+  const __m128 eps = _mm_set1_ps(ZERO_THRESHOLD);
+
+  unsigned char *bytes = reinterpret_cast<unsigned char *>(facing);
+
+  for (int i = begin; i < end; i += 8)
+  {
+    int mask = 0;
+
+    for (int j = 0; j < 8; j += 4)
+    {
+      __m128 nl = _mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(_mm_loadu_ps(&data.nx[i + j]), lx),
+            _mm_mul_ps(_mm_loadu_ps(&data.ny[i + j]), ly)),
+          _mm_mul_ps(_mm_loadu_ps(&data.nz[i + j]), lz));
+      __m128 v = _mm_sub_ps(_mm_mul_ps(lw, _mm_loadu_ps(&data.d[i + j])), nl);
+
+      mask |= _mm_movemask_ps(_mm_cmpgt_ps(v, eps)) << j;
+    }
+
+    bytes[i >> 3] = mask;
+  }
+}
+
+
+// ----------------------------------------------------------------------------
+// AVX2 versions. Edges gather the two words of the bitmask they need, eight
+// edges at a time, and only the silhouette edges are written out.
+// ----------------------------------------------------------------------------
+
+
+__attribute__((target("avx2")))
+static void findLightFacingAVX2 (const SilhouetteData& data, const Vec3& l,
+    const int& begin, const int& end, uint *facing)
+{
+  const __m256 lx  = _mm256_set1_ps(l.x);
+  const __m256 ly  = _mm256_set1_ps(l.y);
+  const __m256 lz  = _mm256_set1_ps(l.z);
+  const __m256 lw  = _mm256_set1_ps(l.w);
+  const __m256 eps = _mm256_set1_ps(ZERO_THRESHOLD);
+
+  unsigned char *bytes = reinterpret_cast<unsigned char *>(facing);
+
+  for (int i = begin; i < end; i += 8)
+  {
+    __m256 nl = _mm256_add_ps(_mm256_add_ps(
+          _mm256_mul_ps(_mm256_loadu_ps(&data.nx[i]), lx),
+          _mm256_mul_ps(_mm256_loadu_ps(&data.ny[i]), ly)),
+        _mm256_mul_ps(_mm256_loadu_ps(&data.nz[i]), lz));
+    __m256 v = _mm256_sub_ps(_mm256_mul_ps(lw, _mm256_loadu_ps(&data.d[i])),
+        nl);
+
+    bytes[i >> 3] = _mm256_movemask_ps(_mm256_cmp_ps(v, eps, _CMP_GT_OQ));
+  }
+}
+
+
+__attribute__((target("avx2")))
+static int testEdgeListAVX2 (const int *list, const int *f1s,
+    const int *f2s, const int& count, const uint *facing, int *out)
+{
+  const __m256i bits = _mm256_set1_epi32(31);
+  const __m256i one  = _mm256_set1_epi32(1);
+  const int *words   = reinterpret_cast<const int *>(facing);
+
+  int n = 0;
+  int e = 0;
+
+  for (; e + 8 <= count; e += 8)
+  {
+    __m256i f1 = _mm256_loadu_si256((const __m256i *) &f1s[e]);
+    __m256i f2 = _mm256_loadu_si256((const __m256i *) &f2s[e]);
+
+    __m256i w1 = _mm256_i32gather_epi32(words, _mm256_srli_epi32(f1, 5), 4);
+    __m256i w2 = _mm256_i32gather_epi32(words, _mm256_srli_epi32(f2, 5), 4);
+
+    __m256i a = _mm256_and_si256(
+        _mm256_srlv_epi32(w1, _mm256_and_si256(f1, bits)), one);
+    __m256i b = _mm256_and_si256(
+        _mm256_srlv_epi32(w2, _mm256_and_si256(f2, bits)), one);
+
+    int ma = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(a, 31)));
+    int mb = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_slli_epi32(b, 31)));
+
+    for (int m = ma ^ mb; m != 0; m &= m - 1)
+    {
+      int k = __builtin_ctz(m);
+      out[n++] = list[e + k] * 2 + ((ma >> k) & 1);
+    }
+  }
+
+  // The lists aren't padded, so any left over are done one at a time.
+  return n + testEdgeListPlain(list + e, f1s + e, f2s + e, count - e, facing,
+      out + n);
+}
+
+#endif // SILHOUETTE_X86
+
+
+// ----------------------------------------------------------------------------
+// Dispatch.
+// ----------------------------------------------------------------------------
+
+
+static void findLightFacingRange (const SilhouetteData& data,
+    const Vec3& lightPos, const int& begin, const int& end, uint *facing)
+{
+#ifdef SILHOUETTE_X86
+  if (currentSimd == SIMD_AVX2)
+    findLightFacingAVX2(data, lightPos, begin, end, facing);
+  else if (currentSimd == SIMD_SSE)
+    findLightFacingSSE(data, lightPos, begin, end, facing);
+  else
+#endif
+    findLightFacingPlain(data, lightPos, begin, end, facing);
+}
+
+
+//
+// Fills facing with one bit per face, set when the face faces the light. The
+// light position must be in the model's local space.
+//
+void findLightFacing (const SilhouetteData& data, const Vec3& lightPos,
+    vector<uint>& facing)
+{
+  facing.assign(data.getMaskSize(), 0);
+
+  if (facing.size() == 0)
+    return;
+
+  findLightFacingRange(data, lightPos, 0, data.nx.size(), &facing[0]);
+}
+
+
+//
+// Fills edges with the silhouette edges for a light facing bitmask, in edge
+// order. Each is written as (edge index * 2 + reversed), see above. Only
+// the candidate edges are tested.
+//
+void findSilhouetteEdges (const SilhouetteData& data,
+    const vector<uint>& facing, vector<int>& edges)
+{
+  int count = data.candidateEdges.size();
+  edges.resize(count);
+
+  if (count == 0)
+    return;
+
+  const int *list = &data.candidateEdges[0];
+  const int *f1s  = &data.candidateF1[0];
+  const int *f2s  = &data.candidateF2[0];
+  int n;
+
+#ifdef SILHOUETTE_X86
+  if (currentSimd == SIMD_AVX2)
+    n = testEdgeListAVX2(list, f1s, f2s, count, &facing[0], &edges[0]);
+  else
+#endif
+    n = testEdgeListPlain(list, f1s, f2s, count, &facing[0], &edges[0]);
+
+  edges.resize(n);
+}
+
+
+// ----------------------------------------------------------------------------
+// Clusters.
+// ----------------------------------------------------------------------------
+
+
+//
+// Bounds the facing test over every face of a cluster. With D = w * C - L
+// at angle t to the cone's axis, the normals make angles with D between
+// t - cone and t + cone, so dot(N, D) is between |D| cos(t + cone) and
+// |D| cos(t - cone), unless those pass straight through D or away from it.
+// The angle sums are worked out from the sines and cosines.
+//
+static ClusterSide classifyCluster (const FaceCluster& cluster,
+    const Vec3& l)
+{
+  Vec3 toCenter = l.w * cluster.center - l;
+  float dist = toCenter.mag();
+  float spread = fabsf(l.w) * cluster.radius;
+  float slack = CLUSTER_SLACK * (fabsf(l.w) * (cluster.center.mag() +
+      cluster.radius) + l.mag());
+
+  // |D| cos(t) and |D| sin(t).
+  float along = dot(cluster.axis, toCenter);
+  float across = crossProduct(cluster.axis, toCenter).mag();
+
+  float least = -dist;
+  if (along > -dist * cluster.cosCone)
+    least = along * cluster.cosCone - across * cluster.sinCone;
+
+  float most = dist;
+  if (along < dist * cluster.cosCone)
+    most = along * cluster.cosCone + across * cluster.sinCone;
+
+  if (least - spread - slack > ZERO_THRESHOLD)
+    return CLUSTER_FRONT;
+  if (most + spread + slack < ZERO_THRESHOLD)
+    return CLUSTER_BACK;
+  return CLUSTER_MIXED;
+}
+
+
+//
+// Sets the bits of faces [begin, end), begin being a multiple of 32.
+//
+static void setFacing (const int& begin, const int& end, uint *facing)
+{
+  int i = begin >> 5;
+  for (; i < end >> 5; i++)
+    facing[i] = ~0u;
+
+  if (end & 31)
+    facing[i] |= (1u << (end & 31)) - 1;
+}
+
+
+//
+// Tests part of the clustered edges against a light facing bitmask, adding
+// the silhouette edges to edges[0, n) as findSilhouetteEdges() writes them.
+// Edges are tested EDGE_CHUNK at a time, and edges only grows by a chunk
+// when one might not fit. Clearing room for every edge of a big model would
+// cost more than the search.
+//
+static void testEdges (const SilhouetteData& data, const int& begin,
+    const int& end, const uint *facing, vector<int>& edges, int& n)
+{
+  for (int i = begin; i < end; i += EDGE_CHUNK)
+  {
+    int count = std::min(end - i, EDGE_CHUNK);
+
+    if (edges.size() < n + count)
+      edges.resize(n + EDGE_CHUNK);
+
+    const int *list = &data.clusterEdges[i];
+    const int *f1s  = &data.clusterF1[i];
+    const int *f2s  = &data.clusterF2[i];
+
+#ifdef SILHOUETTE_X86
+    if (currentSimd == SIMD_AVX2)
+      n += testEdgeListAVX2(list, f1s, f2s, count, facing, &edges[n]);
+    else
+#endif
+      n += testEdgeListPlain(list, f1s, f2s, count, facing, &edges[n]);
+  }
+}
+
+
+//
+// Settles a cluster in one go if it can, otherwise its children (or faces,
+// for a leaf) are looked at. Clusters which couldn't be settled are added
+// to mixed, their edges still need testing.
+//
+static void findClusterFacing (const SilhouetteData& data, const int& node,
+    const Vec3& l, uint *facing, vector<int>& mixed)
+{
+  const FaceCluster& cluster = data.clusters[node];
+
+  switch (classifyCluster(cluster, l))
+  {
+    case CLUSTER_BACK:
+      return;
+
+    case CLUSTER_FRONT:
+      setFacing(cluster.faceBegin, cluster.faceEnd, facing);
+      return;
+
+    default:
+      break;
+  }
+
+  mixed.push_back(node);
+
+  if (cluster.second == -1)
+  {
+    int end = (cluster.faceEnd + SIMD_WIDTH - 1) / SIMD_WIDTH * SIMD_WIDTH;
+    findLightFacingRange(data, l, cluster.faceBegin, end, facing);
+  }
+  else
+  {
+    findClusterFacing(data, node + 1, l, facing, mixed);
+    findClusterFacing(data, cluster.second, l, facing, mixed);
+  }
+}
+
+
+//
+// Gives the same light facing bitmask and silhouette edges as
+// findLightFacing() and findSilhouetteEdges(), but goes through the cluster
+// tree so that only clusters the silhouette passes through are looked at
+// closely. Edges aren't in edge order. Small models have no tree, and just
+// use the kernels on everything.
+//
+// The edges are only tested once every face is done. Reading the bitmask
+// straight after writing it, a cluster at a time, stalls on the writes.
+//
+void findClusteredSilhouette (const SilhouetteData& data,
+    const Vec3& lightPos, vector<uint>& facing, vector<int>& edges)
+{
+  if (data.clusters.size() == 0)
+  {
+    findLightFacing(data, lightPos, facing);
+    findSilhouetteEdges(data, facing, edges);
+    return;
+  }
+
+  facing.assign(data.getMaskSize(), 0);
+
+  vector<int> mixed;
+  findClusterFacing(data, 0, lightPos, &facing[0], mixed);
+
+  int n = 0;
+  for (int i = 0; i < mixed.size(); i++)
+  {
+    const FaceCluster& cluster = data.clusters[mixed[i]];
+    testEdges(data, cluster.edgeBegin, cluster.edgeEnd, &facing[0], edges, n);
+  }
+
+  testEdges(data, data.openEdgeBegin, data.clusterEdges.size(), &facing[0],
+      edges, n);
+
+  edges.resize(n);
+}
+
+
+// ----------------------------------------------------------------------------
+// Convex models.
+// ----------------------------------------------------------------------------
+
+
+//
+// An edge as findSilhouetteEdges() writes it, or -1 if it isn't on the
+// silhouette.
+//
+static int testEdge (const SilhouetteData& data, const vector<uint>& facing,
+    const int& e)
+{
+  uint a = isLightFacing(facing, data.f1[e]);
+  uint b = isLightFacing(facing, data.f2[e]);
+
+  return (a != b) ? e * 2 + a : -1;
+}
+
+
+//
+// Finds the silhouette of a convex model by following it around, starting
+// from the first edge of the previous silhouette which is still on it.
+// Edges are all oriented the same way around the light facing faces. From
+// the end of each one, the next is found by turning around its end vertex
+// through the light facing faces until the first edge with a face that
+// isn't. Faces near the threshold can leave light facing faces which only
+// touch at a vertex, so the turn carries on around the vertex, and any
+// other silhouette edge coming into it starts another loop once this one
+// is done. Gives the same edges as findSilhouetteEdges(), starting from a
+// different one. Returns false, leaving edges in no particular state, if
+// the model isn't convex (or is too small for it to be worth it) or none
+// of the previous edges are still on the silhouette, and the edges have to
+// be tested after all.
+//
+bool walkConvexSilhouette (const SilhouetteData& data,
+    const vector<uint>& facing, const vector<int>& previous,
+    vector<int>& edges)
+{
+  if (!data.convex || data.faceCount < MIN_WALKED_FACES)
+    return false;
+
+  int first = -1;
+  for (int i = 0; i < previous.size() && first == -1; i++)
+    first = testEdge(data, facing, previous[i] >> 1);
+
+  if (first == -1)
+    return false;
+
+  int limit = data.candidateEdges.size();
+  int turns = 0;
+  vector<int> pending(1, first);
+  edges.clear();
+
+  while (!pending.empty())
+  {
+    int loop = pending.back();
+    pending.pop_back();
+
+    if (std::find(edges.begin(), edges.end(), loop) != edges.end())
+      continue;
+
+    for (int code = loop; ; )
+    {
+      if (edges.size() == limit)
+        return false;
+
+      edges.push_back(code);
+
+      // Reversed edges run from v2 to v1, and have f1 light facing.
+      int start  = code >> 1;
+      int end    = data.edgeVerts[start * 2 + ((code & 1) ? 0 : 1)];
+      int face   = (code & 1) ? data.f1[start] : data.f2[start];
+      int across = start;
+      int next   = -1;
+
+      for (;;)
+      {
+        if (++turns > data.faceCount)
+          return false;
+
+        // The face's other edge at the vertex.
+        int other = -1;
+        for (int k = face * 3; k < face * 3 + 3; k++)
+        {
+          int e = data.allFaceEdges[k];
+
+          if (e != across && (data.edgeVerts[e * 2] == end ||
+              data.edgeVerts[e * 2 + 1] == end))
+            other = e;
+        }
+
+        if (other == -1)
+          return false;
+
+        if (other == start)
+          break;
+
+        int beyond = (data.f1[other] == face) ? data.f2[other] :
+            data.f1[other];
+        bool lit = isLightFacing(facing, face);
+
+        if (lit != isLightFacing(facing, beyond))
+        {
+          if (lit && next == -1)
+            next = testEdge(data, facing, other);
+          else if (!lit)
+            pending.push_back(testEdge(data, facing, other));
+        }
+
+        face = beyond;
+        across = other;
+      }
+
+      if (next == -1 || data.edgeVerts[(next >> 1) * 2 + (next & 1)] != end)
+        return false;
+
+      if (next == loop)
+        break;
+
+      code = next;
+    }
+  }
+
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// Incremental updates.
+// ----------------------------------------------------------------------------
+
+
+//
+// Finds the faces whose planes pass within range of the light, nearest
+// first. Normals are unit length, so moving the light by some distance
+// changes the facing test of a face by at most that distance, and a face
+// further than range away can't change sides until the light has moved
+// further than range.
+//
+void findNearFaces (const SilhouetteData& data, const Vec3& l,
+    const float& range, vector<NearFace>& faces)
+{
+  faces.clear();
+
+  for (int i = 0; i < data.faceCount; i++)
+  {
+    float nl = data.nx[i] * l.x + data.ny[i] * l.y + data.nz[i] * l.z;
+    float margin = fabsf(l.w * data.d[i] - nl - ZERO_THRESHOLD);
+
+    if (margin <= range)
+    {
+      NearFace face = { margin, i };
+      faces.push_back(face);
+    }
+  }
+
+  std::sort(faces.begin(), faces.end());
+}
+
+
+//
+// Records where each edge is in a list from findSilhouetteEdges(), -1 for
+// edges that aren't on the silhouette.
+//
+void findEdgeSlots (const SilhouetteData& data, const vector<int>& edges,
+    vector<int>& slots)
+{
+  slots.assign(data.edgeCount, -1);
+
+  for (int i = 0; i < edges.size(); i++)
+    slots[edges[i] >> 1] = i;
+}
+
+
+//
+// Brings a light facing bitmask and silhouette up to date for a light which
+// has moved a total distance of moved since faces was found. Only the near
+// faces within that distance are tested again, and only the edges of faces
+// which changed sides are looked at. Edges are added to the end of the
+// silhouette and removed by moving the last edge into their place, so the
+// silhouette is no longer in edge order. Returns the number of faces that
+// changed sides.
+//
+int updateSilhouette (const SilhouetteData& data, const Vec3& l,
+    const float& moved, const vector<NearFace>& faces, vector<uint>& facing,
+    vector<int>& edges, vector<int>& slots)
+{
+  int flipped = 0;
+
+  for (int i = 0; i < faces.size() && faces[i].margin <= moved; i++)
+  {
+    int f = faces[i].face;
+
+    float nl = data.nx[f] * l.x + data.ny[f] * l.y + data.nz[f] * l.z;
+    bool lit = l.w * data.d[f] - nl > ZERO_THRESHOLD;
+
+    if (lit == isLightFacing(facing, f))
+      continue;
+
+    facing[f >> 5] ^= 1u << (f & 31);
+    flipped++;
+
+    for (int j = f * 3; j < f * 3 + 3 && data.faceEdges[j] != -1; j++)
+    {
+      int e = data.faceEdges[j];
+      uint a = isLightFacing(facing, data.f1[e]);
+      uint b = isLightFacing(facing, data.f2[e]);
+
+      if (a != b)
+      {
+        if (slots[e] == -1)
+        {
+          slots[e] = edges.size();
+          edges.push_back(0);
+        }
+
+        edges[slots[e]] = e * 2 + a;
+      }
+      else if (slots[e] != -1)
+      {
+        int last = edges.back();
+        edges[slots[e]] = last;
+        slots[last >> 1] = slots[e];
+        slots[e] = -1;
+        edges.pop_back();
+      }
+    }
+  }
+
+  return flipped;
+}
+
+
+SilhouetteSimd getSilhouetteSimd (void)
+{
+  return currentSimd;
+}
+
+
+//
+// Picks the kernels to use, mostly for benchmarking. Fails if the CPU
+// doesn't support them.
+//
+bool setSilhouetteSimd (const SilhouetteSimd& simd)
+{
+  if (simd > bestSimd)
+    return false;
+
+  currentSimd = simd;
+  return true;
+}
+
+
+// ----------------------------------------------------------------------------
+// DirectionalSilhouettes implementation
+// ----------------------------------------------------------------------------
+
+
+DirectionalSilhouettes::DirectionalSilhouettes (void)
+{
+  pthread_mutex_init(&lock, NULL);
+}
+
+
+DirectionalSilhouettes::DirectionalSilhouettes (const DirectionalSilhouettes&)
+{
+  pthread_mutex_init(&lock, NULL);
+}
+
+
+DirectionalSilhouettes::~DirectionalSilhouettes (void)
+{
+  clear();
+  pthread_mutex_destroy(&lock);
+}
+
+
+DirectionalSilhouettes& DirectionalSilhouettes::operator= (
+    const DirectionalSilhouettes&)
+{
+  clear();
+  return *this;
+}
+
+
+//
+// The bin of the octahedral map a direction falls in. The direction is
+// projected onto the octahedron |x| + |y| + |z| = 1, and the lower half is
+// folded out over the corners of the upper half to make a square.
+//
+int DirectionalSilhouettes::findBin (const Vec3& dir)
+{
+  float sum = fabsf(dir.x) + fabsf(dir.y) + fabsf(dir.z);
+  float u = dir.x / sum;
+  float v = dir.y / sum;
+
+  if (dir.z < 0.0f)
+  {
+    float folded = (1.0f - fabsf(v)) * (u < 0.0f ? -1.0f : 1.0f);
+    v = (1.0f - fabsf(u)) * (v < 0.0f ? -1.0f : 1.0f);
+    u = folded;
+  }
+
+  int i = (int) ((u + 1.0f) * 0.5f * DIRECTION_BINS);
+  int j = (int) ((v + 1.0f) * 0.5f * DIRECTION_BINS);
+
+  i = std::min(std::max(i, 0), DIRECTION_BINS - 1);
+  j = std::min(std::max(j, 0), DIRECTION_BINS - 1);
+
+  return j * DIRECTION_BINS + i;
+}
+
+
+//
+// The unit direction through the middle of a bin, see findBin().
+//
+Vec3 DirectionalSilhouettes::getBinDirection (const int& bin)
+{
+  float u = ((bin % DIRECTION_BINS) + 0.5f) * 2.0f / DIRECTION_BINS - 1.0f;
+  float v = ((bin / DIRECTION_BINS) + 0.5f) * 2.0f / DIRECTION_BINS - 1.0f;
+  float z = 1.0f - fabsf(u) - fabsf(v);
+
+  if (z < 0.0f)
+  {
+    float unfolded = (1.0f - fabsf(v)) * (u < 0.0f ? -1.0f : 1.0f);
+    v = (1.0f - fabsf(u)) * (v < 0.0f ? -1.0f : 1.0f);
+    u = unfolded;
+  }
+
+  Vec3 dir(u, v, z);
+  dir.unitize();
+  return dir;
+}
+
+
+//
+// Gives the light facing faces and silhouette edges for a directional light
+// (lightPos.w is 0), as findClusteredSilhouette() would for the middle of
+// its bin. The first Caster to ask for a bin finds them,
+// everyone after just gets a copy.
+//
+void DirectionalSilhouettes::lookup (const SilhouetteData& data,
+    const Vec3& lightPos, vector<uint>& facing, vector<int>& edges)
+{
+  int bin = findBin(lightPos);
+
+  pthread_mutex_lock(&lock);
+
+  map<int, Entry *>::iterator found = entries.find(bin);
+  if (found != entries.end())
+  {
+    facing = found->second->facing;
+    edges = found->second->edges;
+    pthread_mutex_unlock(&lock);
+    return;
+  }
+
+  pthread_mutex_unlock(&lock);
+
+  // The light's length is kept, it scales the facing test's threshold.
+  Vec3 dir = lightPos.mag() * getBinDirection(bin);
+  dir.w = 0.0f;
+
+  Entry *entry = new Entry();
+  findClusteredSilhouette(data, dir, entry->facing, entry->edges);
+
+  facing = entry->facing;
+  edges = entry->edges;
+
+  // Another thread may have found the same bin in the meantime.
+  pthread_mutex_lock(&lock);
+
+  if (entries.size() >= MAX_DIRECTIONS)
+  {
+    for (map<int, Entry *>::iterator i = entries.begin(); i != entries.end();
+        ++i)
+      delete i->second;
+    entries.clear();
+  }
+
+  if (!entries.insert(std::make_pair(bin, entry)).second)
+    delete entry;
+
+  pthread_mutex_unlock(&lock);
+}
+
+
+//
+// Throws away every silhouette, for when the model changes.
+//
+void DirectionalSilhouettes::clear (void)
+{
+  pthread_mutex_lock(&lock);
+
+  for (map<int, Entry *>::iterator i = entries.begin(); i != entries.end();
+      ++i)
+    delete i->second;
+  entries.clear();
+
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,234 @@
+//
+// silhouette.h
+//
+// Kernels for finding which faces of a model face a light, and which of its
+// edges form the silhouette. The face planes and edge faces are kept as
+// separate arrays (rather than the Face and Edge structs) so they can be
+// processed several at a time with SSE or AVX2, whichever the CPU has.
+//
+// For lights that only move a little between frames, the light facing faces
+// and silhouette can also be updated in place, only looking at the faces
+// whose planes pass close to the light. Silhouettes for directional lights
+// are kept by direction and shared between every Caster of a model.
+//
+// Neighbouring faces in the same plane always face the same way, so the
+// edges between them can never be on a silhouette. Each such group of faces
+// is given exactly the same plane, and only the other edges are tested.
+//
+// A convex model's silhouette is a single loop, which is followed around
+// from an edge of the last silhouette instead of testing every edge.
+//
+// Faces are also grouped into a tree of clusters, each with a sphere around
+// its vertices and a cone around its normals. Clusters which face the light
+// entirely, or not at all, are settled without looking at their faces, and
+// only the edges of mixed clusters are tested.
+//
+
+
+#ifndef _SILHOUETTE_H_
+#define _SILHOUETTE_H_
+
+
+#include <vector>
+#include <map>
+#include <pthread.h>
+
+#include "../ltypes.h"
+#include "../math/vec3.h"
+
+using std::vector;
+using std::map;
+
+
+class Model;
+
+
+// Used to fix silhouette calculations by providing a threshold for float
+// values to equal 0.
+extern const float ZERO_THRESHOLD;
+
+
+// Largest number of faces in a cluster which isn't split any further.
+const int CLUSTER_FACES = 64;
+
+
+// Instruction sets the kernels come in.
+enum SilhouetteSimd
+{
+  SIMD_NONE,
+  SIMD_SSE,
+  SIMD_AVX2
+};
+
+
+struct SilhouetteData;
+
+
+//
+// The silhouettes of a model for directional lights, which only depend on
+// the light's direction in the model's space. Directions are binned on an
+// octahedral map, and the silhouette found for the middle of a bin is used
+// for every direction in it and by every Caster of the model. Can be used
+// from several threads at once. Copies start out empty.
+//
+class DirectionalSilhouettes
+{
+
+private:
+
+  struct Entry
+  {
+    vector<uint> facing;
+    vector<int> edges;
+  };
+
+  map<int, Entry *> entries;
+  pthread_mutex_t lock;
+
+  static int findBin (const Vec3& dir);
+  static Vec3 getBinDirection (const int& bin);
+
+public:
+
+  DirectionalSilhouettes (void);
+  DirectionalSilhouettes (const DirectionalSilhouettes& other);
+  ~DirectionalSilhouettes (void);
+
+  DirectionalSilhouettes& operator= (const DirectionalSilhouettes& other);
+
+  void lookup (const SilhouetteData& data, const Vec3& lightPos,
+      vector<uint>& facing, vector<int>& edges);
+  void clear (void);
+};
+
+
+//
+// A node in the tree of face clusters. Every face normal lies within a cone
+// around axis, and every vertex within the sphere. Nodes are stored
+// depth first, so the first child of a node comes straight after it.
+//
+struct FaceCluster
+{
+  Vec3 center;
+  float radius;
+
+  Vec3 axis;                    // Unit length.
+  float cosCone, sinCone;       // Of the angle the normals can be off axis.
+
+  int faceBegin, faceEnd;       // Faces within the cluster.
+  int edgeBegin, edgeEnd;       // Its part of clusterEdges, the edges
+                                // between its children (or faces, if a leaf).
+  int second;                   // Index of the second child, -1 for a leaf.
+};
+
+
+//
+// Structure of arrays copy of the parts of a Model needed for silhouettes.
+// The arrays are padded to a multiple of the widest kernel with faces that
+// never face a light. Edges without a second face use the first padding
+// face instead of -1, so they need no special case.
+//
+struct SilhouetteData
+{
+  int faceCount;
+  int edgeCount;
+
+  vector<float> nx, ny, nz;     // Face normals.
+  vector<float> d;              // dot(normal, first vertex) for each face.
+
+  vector<int> f1, f2;           // Faces either side of each edge.
+
+  vector<int> candidateEdges;   // Edges which can be on a silhouette, with
+  vector<int> candidateF1;      // their faces copied alongside so they're
+  vector<int> candidateF2;      // read in order.
+
+  vector<int> faceEdges;        // Three candidate edges per face, -1 if
+                                // missing.
+  float radius;                 // Furthest vertex from the origin.
+
+  bool convex;                  // Closed, in one piece and convex.
+  vector<int> edgeVerts;        // For convex models, the two vertices of
+  vector<int> allFaceEdges;     // each edge and all three edges of each
+                                // face, including those between faces in
+                                // the same plane.
+
+  vector<FaceCluster> clusters; // Tree over the faces, root first.
+  vector<int> clusterEdges;     // Edges in the order of the clusters, then
+  vector<int> clusterF1;        // those with only one face (from
+  vector<int> clusterF2;        // openEdgeBegin on). Their faces are copied
+  int openEdgeBegin;            // so they're read in order too.
+
+  mutable DirectionalSilhouettes directional;
+
+  SilhouetteData (void)
+    : faceCount(0), edgeCount(0), radius(0.0f), convex(false),
+      openEdgeBegin(0)
+  { }
+
+  void build (const Model& model);
+  void addFaceEdge (const int& face, const int& edge);
+  void groupCoplanarFaces (const Model& model);
+  void findCandidateEdges (const Model& model);
+  void findConvex (const Model& model);
+  int addCluster (const Model& model, const int& begin, const int& end);
+  void buildClusters (const Model& model);
+
+  // Words needed for a bitmask with one bit per (padded) face.
+  int getMaskSize (void) const
+  { return (nx.size() + 31) / 32; }
+};
+
+
+//
+// A face whose plane passes close to a light, and how close. The light has
+// to move further than margin before the face can change sides.
+//
+struct NearFace
+{
+  float margin;
+  int face;
+
+  bool operator< (const NearFace& other) const
+  { return margin < other.margin; }
+};
+
+
+//
+// Tests a bit of a face bitmask made by findLightFacing().
+//
+inline bool isLightFacing (const vector<uint>& facing, const int& face)
+{
+  return (facing[face >> 5] >> (face & 31)) & 1;
+}
+
+
+void findLightFacing (const SilhouetteData& data, const Vec3& lightPos,
+    vector<uint>& facing);
+
+void findSilhouetteEdges (const SilhouetteData& data,
+    const vector<uint>& facing, vector<int>& edges);
+
+void findClusteredSilhouette (const SilhouetteData& data,
+    const Vec3& lightPos, vector<uint>& facing, vector<int>& edges);
+
+int splitFaceRange (const int& begin, const int& end);
+
+bool walkConvexSilhouette (const SilhouetteData& data,
+    const vector<uint>& facing, const vector<int>& previous,
+    vector<int>& edges);
+
+void findNearFaces (const SilhouetteData& data, const Vec3& lightPos,
+    const float& range, vector<NearFace>& faces);
+
+void findEdgeSlots (const SilhouetteData& data, const vector<int>& edges,
+    vector<int>& slots);
+
+int updateSilhouette (const SilhouetteData& data, const Vec3& lightPos,
+    const float& moved, const vector<NearFace>& faces, vector<uint>& facing,
+    vector<int>& edges, vector<int>& slots);
+
+SilhouetteSimd getSilhouetteSimd (void);
+bool setSilhouetteSimd (const SilhouetteSimd& simd);
+
+
+#endif // _SILHOUETTE_H_
@@ -0,0 +1,482 @@
+//
+// simplify.cpp
+//
+// Quadric error edge collapse. Every vertex keeps the sum of the squared
+// distance quadrics of the planes of the faces around it. The edge whose
+// collapse to a single vertex moves it least from those planes is always
+// collapsed next, found with a heap whose stale entries are skipped when
+// they come up. Collapses which would change the topology or fold a face
+// over are never made, so a closed manifold mesh stays one.
+//
+
+
+#include "simplify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+
+
+// A face whose normal would turn by more than this (as the cosine of the
+// angle) is treated as folding over, and the collapse isn't made.
+static const double MIN_FOLD_COS = 0.2;
+
+// An optimal collapse position further than this from the middle of the
+// edge, as a multiple of the edge's length, is treated as unstable and one
+// of the ends or the middle is used instead.
+static const double MAX_TARGET_REACH = 2.0;
+
+
+//
+// The sum of the squared distances from a point to some planes, kept as the
+// ten different entries of a symmetric 4x4 matrix.
+//
+struct Quadric
+{
+  double q[10];                 // aa ab ac ad bb bc bd cc cd dd
+
+  Quadric (void)
+  { std::fill(q, q + 10, 0.0); }
+
+  void addPlane (const double& a, const double& b, const double& c,
+      const double& d)
+  {
+    q[0] += a * a;  q[1] += a * b;  q[2] += a * c;  q[3] += a * d;
+    q[4] += b * b;  q[5] += b * c;  q[6] += b * d;
+    q[7] += c * c;  q[8] += c * d;
+    q[9] += d * d;
+  }
+
+  void operator+= (const Quadric& other)
+  {
+    for (int i = 0; i < 10; i++)
+      q[i] += other.q[i];
+  }
+
+  double evaluate (const Vec3& v) const
+  {
+    double x = v.x, y = v.y, z = v.z;
+    double e = q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z +
+        2.0 * q[3] * x + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y +
+        q[7] * z * z + 2.0 * q[8] * z + q[9];
+
+    // Rounding can take a perfect fit just below zero.
+    return e > 0.0 ? e : 0.0;
+  }
+};
+
+
+//
+// A possible collapse of the edge between v1 and v2. The stamps are the two
+// vertices' versions when it was found, if either has changed since it is
+// out of date. Where the vertex goes is found again when it comes up, to
+// keep the heap small.
+//
+struct Collapse
+{
+  double cost;
+  int v1, v2;
+  int stamp1, stamp2;
+
+  bool operator> (const Collapse& other) const
+  { return cost > other.cost; }
+};
+
+
+typedef std::priority_queue<Collapse, vector<Collapse>,
+    std::greater<Collapse> > CollapseQueue;
+
+
+//
+// The working state of the mesh while it is simplified. Faces are never
+// moved, only marked as gone, and each vertex keeps the faces still using
+// it.
+//
+struct SimplifyState
+{
+  vector<Vec3> pos;
+  vector<Quadric> quadrics;
+  vector<int> stamps;
+  vector<bool> vertGone;
+  vector<vector<int> > vertFaces;
+
+  vector<int> corners;          // Three per face.
+  vector<bool> faceGone;
+  int liveFaces;
+
+  CollapseQueue queue;
+};
+
+
+//
+// Finds the point which the quadric of a collapse puts nearest its planes,
+// by solving the 3x3 system its gradient gives. If that's singular, or
+// lands too far from the edge (as it does for nearly flat surfaces), the
+// better of the two ends and the middle is used.
+//
+static void findTarget (const Quadric& quadric, const Vec3& a, const Vec3& b,
+    Vec3& target, double& cost)
+{
+  const double *q = quadric.q;
+
+  double c00 = q[4] * q[7] - q[5] * q[5];
+  double c01 = q[2] * q[5] - q[1] * q[7];
+  double c02 = q[1] * q[5] - q[2] * q[4];
+  double det = q[0] * c00 + q[1] * c01 + q[2] * c02;
+
+  double scale = std::max(q[0], std::max(q[4], q[7]));
+  Vec3 mid = 0.5f * (a + b);
+
+  if (fabs(det) > 1e-9 * scale * scale * scale)
+  {
+    double c11 = q[0] * q[7] - q[2] * q[2];
+    double c12 = q[1] * q[2] - q[0] * q[5];
+    double c22 = q[0] * q[4] - q[1] * q[1];
+
+    double x = -(c00 * q[3] + c01 * q[6] + c02 * q[8]) / det;
+    double y = -(c01 * q[3] + c11 * q[6] + c12 * q[8]) / det;
+    double z = -(c02 * q[3] + c12 * q[6] + c22 * q[8]) / det;
+
+    Vec3 solved((float) x, (float) y, (float) z);
+    if ((solved - mid).mag() <= MAX_TARGET_REACH * (b - a).mag())
+    {
+      target = solved;
+      cost = quadric.evaluate(target);
+      return;
+    }
+  }
+
+  target = mid;
+  cost = quadric.evaluate(mid);
+
+  double costA = quadric.evaluate(a);
+  if (costA < cost)
+  {
+    target = a;
+    cost = costA;
+  }
+
+  double costB = quadric.evaluate(b);
+  if (costB < cost)
+  {
+    target = b;
+    cost = costB;
+  }
+}
+
+
+//
+// Works out the cheapest collapse of the edge between two vertices.
+//
+static Collapse findCollapse (const SimplifyState& state, const int& v1,
+    const int& v2, Vec3& target)
+{
+  Quadric quadric = state.quadrics[v1];
+  quadric += state.quadrics[v2];
+
+  Collapse collapse;
+  collapse.v1 = v1;
+  collapse.v2 = v2;
+  collapse.stamp1 = state.stamps[v1];
+  collapse.stamp2 = state.stamps[v2];
+  findTarget(quadric, state.pos[v1], state.pos[v2], target, collapse.cost);
+
+  return collapse;
+}
+
+
+//
+// Fills ring with the sorted vertices sharing a face with v.
+//
+static void findRing (const SimplifyState& state, const int& v,
+    vector<int>& ring)
+{
+  ring.clear();
+
+  const vector<int>& faces = state.vertFaces[v];
+  for (int i = 0; i < faces.size(); i++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      int w = state.corners[faces[i] * 3 + k];
+      if (w != v)
+        ring.push_back(w);
+    }
+  }
+
+  std::sort(ring.begin(), ring.end());
+  ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+}
+
+
+//
+// True if a face of v which doesn't also use other would turn too far, or
+// become degenerate, with v moved to target.
+//
+static bool foldsOver (const SimplifyState& state, const int& v,
+    const int& other, const Vec3& target)
+{
+  const vector<int>& faces = state.vertFaces[v];
+
+  for (int i = 0; i < faces.size(); i++)
+  {
+    const int *c = &state.corners[faces[i] * 3];
+    if (c[0] == other || c[1] == other || c[2] == other)
+      continue;
+
+    Vec3 before[3], after[3];
+    for (int k = 0; k < 3; k++)
+    {
+      before[k] = state.pos[c[k]];
+      after[k]  = c[k] == v ? target : before[k];
+    }
+
+    Vec3 n0 = crossProduct(before[1] - before[0], before[2] - before[0]);
+    Vec3 n1 = crossProduct(after[1] - after[0], after[2] - after[0]);
+
+    double m0 = n0.mag(), m1 = n1.mag();
+    if (m0 == 0.0)
+      continue;
+
+    if (m1 == 0.0 || dot(n0, n1) < MIN_FOLD_COS * m0 * m1)
+      return true;
+  }
+
+  return false;
+}
+
+
+//
+// True if collapsing the edge keeps the mesh a manifold: the only vertices
+// both ends share are the two across the faces on either side of it.
+//
+static bool keepsManifold (const SimplifyState& state, const int& v1,
+    const int& v2, vector<int>& ring1, vector<int>& ring2)
+{
+  findRing(state, v1, ring1);
+  findRing(state, v2, ring2);
+
+  int shared = 0;
+  vector<int>::const_iterator a = ring1.begin(), b = ring2.begin();
+
+  while (a != ring1.end() && b != ring2.end())
+  {
+    if (*a < *b)
+      ++a;
+    else if (*b < *a)
+      ++b;
+    else
+    {
+      shared++;
+      ++a;
+      ++b;
+    }
+  }
+
+  return shared == 2;
+}
+
+
+//
+// Moves v1 to target and joins v2 onto it. The two faces along the edge go,
+// and v2's other faces use v1 instead.
+//
+static void collapseEdge (SimplifyState& state, const int& v1, const int& v2,
+    const Vec3& target, vector<int>& ring)
+{
+  state.pos[v1] = target;
+  state.quadrics[v1] += state.quadrics[v2];
+
+  const vector<int>& faces2 = state.vertFaces[v2];
+  vector<int>& faces1 = state.vertFaces[v1];
+
+  for (int i = 0; i < faces2.size(); i++)
+  {
+    int f = faces2[i];
+    int *c = &state.corners[f * 3];
+
+    if (c[0] == v1 || c[1] == v1 || c[2] == v1)
+    {
+      state.faceGone[f] = true;
+      state.liveFaces--;
+
+      // Take it off the third vertex too.
+      for (int k = 0; k < 3; k++)
+      {
+        if (c[k] == v1 || c[k] == v2)
+          continue;
+
+        vector<int>& other = state.vertFaces[c[k]];
+        other.erase(std::remove(other.begin(), other.end(), f), other.end());
+      }
+    }
+    else
+    {
+      for (int k = 0; k < 3; k++)
+        if (c[k] == v2)
+          c[k] = v1;
+
+      faces1.push_back(f);
+    }
+  }
+
+  vector<int> live;
+  live.reserve(faces1.size());
+  for (int i = 0; i < faces1.size(); i++)
+    if (!state.faceGone[faces1[i]])
+      live.push_back(faces1[i]);
+  faces1.swap(live);
+
+  state.vertFaces[v2].clear();
+  state.vertGone[v2] = true;
+  state.stamps[v1]++;
+
+  Vec3 unused;
+  findRing(state, v1, ring);
+  for (int i = 0; i < ring.size(); i++)
+    state.queue.push(findCollapse(state, v1, ring[i], unused));
+}
+
+
+//
+// Copies the faces still left, and only the vertices they use.
+//
+static void takeSnapshot (const SimplifyState& state, const double& error,
+    SimplifiedMesh& mesh)
+{
+  vector<int> remap(state.pos.size(), -1);
+
+  mesh.verts.clear();
+  mesh.faces.clear();
+  mesh.faces.reserve(state.liveFaces);
+  mesh.error = (float) sqrt(error);
+
+  for (int f = 0; f < state.faceGone.size(); f++)
+  {
+    if (state.faceGone[f])
+      continue;
+
+    Face face;
+    face.vStart = 0;
+
+    for (int k = 0; k < 3; k++)
+    {
+      int v = state.corners[f * 3 + k];
+      if (remap[v] == -1)
+      {
+        remap[v] = mesh.verts.size();
+        mesh.verts.push_back(state.pos[v]);
+      }
+
+      face.index[k] = remap[v];
+    }
+
+    mesh.faces.push_back(face);
+  }
+}
+
+
+//
+// Simplifies a closed manifold mesh, adding a copy to meshes each time its
+// face count reaches the next of targets, which must be decreasing. Stops
+// early, with fewer copies, if there are no collapses left that keep the
+// mesh manifold without folding it.
+//
+void simplifyMesh (const vector<Vec3>& verts, const vector<Face>& faces,
+    const vector<int>& targets, vector<SimplifiedMesh>& meshes)
+{
+  meshes.clear();
+  if (targets.empty())
+    return;
+
+  SimplifyState state;
+  state.pos = verts;
+  state.quadrics.resize(verts.size());
+  state.stamps.assign(verts.size(), 0);
+  state.vertGone.assign(verts.size(), false);
+  state.vertFaces.resize(verts.size());
+  state.corners.resize(faces.size() * 3);
+  state.faceGone.assign(faces.size(), false);
+  state.liveFaces = faces.size();
+
+  for (int f = 0; f < faces.size(); f++)
+  {
+    const int *c = faces[f].index;
+    for (int k = 0; k < 3; k++)
+    {
+      state.corners[f * 3 + k] = c[k];
+      state.vertFaces[c[k]].push_back(f);
+    }
+
+    Vec3 n = crossProduct(verts[c[1]] - verts[c[0]],
+        verts[c[2]] - verts[c[0]]);
+    if (n.mag() == 0.0f)
+      continue;
+
+    n.unitize();
+    double d = -dot(n, verts[c[0]]);
+
+    for (int k = 0; k < 3; k++)
+      state.quadrics[c[k]].addPlane(n.x, n.y, n.z, d);
+  }
+
+  // Each edge is queued once, from the face where it runs upwards. The heap
+  // is made in one go rather than by pushing them one at a time.
+  vector<Collapse> collapses;
+  collapses.reserve(faces.size() * 3 / 2);
+  Vec3 target;
+
+  for (int f = 0; f < faces.size(); f++)
+  {
+    for (int k = 0; k < 3; k++)
+    {
+      int a = faces[f].index[k], b = faces[f].index[(k + 1) % 3];
+      if (a < b)
+        collapses.push_back(findCollapse(state, a, b, target));
+    }
+  }
+
+  state.queue = CollapseQueue(std::greater<Collapse>(), collapses);
+  vector<Collapse>().swap(collapses);
+
+  vector<int> ring1, ring2;
+  double error = 0.0;
+  int next = 0;
+
+  while (next < targets.size() && !state.queue.empty())
+  {
+    if (state.liveFaces <= targets[next])
+    {
+      meshes.push_back(SimplifiedMesh());
+      takeSnapshot(state, error, meshes.back());
+      next++;
+      continue;
+    }
+
+    Collapse collapse = state.queue.top();
+    state.queue.pop();
+
+    int v1 = collapse.v1, v2 = collapse.v2;
+    if (state.vertGone[v1] || state.vertGone[v2] ||
+        state.stamps[v1] != collapse.stamp1 ||
+        state.stamps[v2] != collapse.stamp2)
+      continue;
+
+    findCollapse(state, v1, v2, target);
+
+    if (!keepsManifold(state, v1, v2, ring1, ring2) ||
+        foldsOver(state, v1, v2, target) ||
+        foldsOver(state, v2, v1, target))
+      continue;
+
+    error = std::max(error, collapse.cost);
+    collapseEdge(state, v1, v2, target, ring1);
+  }
+
+  if (next < targets.size() && state.liveFaces <= targets[next])
+  {
+    meshes.push_back(SimplifiedMesh());
+    takeSnapshot(state, error, meshes.back());
+  }
+}
@@ -0,0 +1,43 @@
+//
+// simplify.h
+//
+// Mesh simplification by quadric error edge collapse (Garland and Heckbert,
+// "Surface Simplification Using Quadric Error Metrics"). Used to make the
+// lower detail shadow proxies of a closed model, see
+// Model::buildShadowProxies(). Only positions are kept, so the results are
+// for finding shadows with and not for drawing.
+//
+
+
+#ifndef _SIMPLIFY_H_
+#define _SIMPLIFY_H_
+
+
+#include <vector>
+
+#include "model.h"
+#include "../math/vec3.h"
+
+using std::vector;
+
+
+//
+// One simplified copy of a mesh. The faces have no vStart or normal, only
+// their corners as indexes into verts.
+//
+struct SimplifiedMesh
+{
+  vector<Vec3> verts;
+  vector<Face> faces;
+
+  // Roughly how far the surface has moved from the original, the square
+  // root of the largest quadric error of any collapse made.
+  float error;
+};
+
+
+void simplifyMesh (const vector<Vec3>& verts, const vector<Face>& faces,
+    const vector<int>& targets, vector<SimplifiedMesh>& meshes);
+
+
+#endif // _SIMPLIFY_H_
@@ -2,12 +2,18 @@
 #include "obj.h"
 #include <cstdio>
 #include <vector>
+%}
 
-int yylex();
-void yyerror(ObjModel *objModel, ObjLoadData *ld, const char *s);
+%code requires {
+typedef void *yyscan_t;
+class ObjModel;
+class ObjLoadData;
+}
 
-%}
+%define api.pure full
 
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner}
 %parse-param {ObjModel *objModel}
 %parse-param {ObjLoadData *ld}
 
@@ -19,8 +25,14 @@ void yyerror(ObjModel *objModel, ObjLoadData *ld, const char *s);
     int integer;
 }
 
+%code {
+int yylex(YYSTYPE *yylval, yyscan_t scanner);
+void yyerror(yyscan_t scanner, ObjModel *objModel, ObjLoadData *ld,
+    const char *s);
+}
+
 %type <str> STRING
-%type <real> REAL
+%type <real> REAL number
 %type <integer> INTEGER
 
 %%
@@ -38,26 +50,37 @@ statement           : vertex
                     | use_material
                     ;
 
-vertex              : V REAL REAL REAL 
+number              : REAL
+                    | INTEGER
+                      { $$ = (float) $1; }
+                    ;
+
+vertex              : V number number number 
                       { ld->vertices.push_back(Vec3($2, $3, $4)); }
-                    | V REAL REAL REAL REAL
+                    | V number number number number
                     ;
 
-vertex_texture      : VT REAL 
+vertex_texture      : VT number 
                       { ld->texCoords.push_back(Vec3($2, 0.0f, 0.0f)); }
-                    | VT REAL REAL
+                    | VT number number
                       { ld->texCoords.push_back(Vec3($2, 1.0f - $3, 0.0f)); }
-                    | VT REAL REAL REAL
+                    | VT number number number
                       { ld->texCoords.push_back(Vec3($2, 1.0f - $3, $4)); }
                     ;
 
-vertex_normal       : VN REAL REAL REAL
+vertex_normal       : VN number number number
                       { ld->normals.push_back(Vec3( $2, $3, $4)); }
                     ;
 
+                    /* Polygons are split into a fan by addFaceVertex. */
 face                : F 
                       { objModel->beginFace(); }
                       vertex_triplet vertex_triplet vertex_triplet
+                      more_triplets
+                    ;
+
+more_triplets       : more_triplets vertex_triplet
+                    |
                     ;
 
 vertex_triplet      : INTEGER
@@ -75,4 +98,3 @@ use_material        : USEMTL STRING
                     ;
 %%
 
-
@@ -0,0 +1,61 @@
+//
+// mapfile.cpp
+//
+// MappedFile implementation using POSIX mmap.
+//
+
+#include "mapfile.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+//
+// Opens and maps the named file. If anything fails the file is left closed,
+// which can be checked with isOpen(). Empty files are open but have no data.
+//
+MappedFile::MappedFile (const string& filename)
+  : fd(-1), data(NULL), size(0)
+{
+  fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1)
+    return;
+
+  struct stat st;
+  if (fstat(fd, &st) == -1)
+  {
+    close(fd);
+    fd = -1;
+    return;
+  }
+
+  size = st.st_size;
+  if (size == 0)
+    return;
+
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    close(fd);
+    fd = -1;
+    size = 0;
+    return;
+  }
+
+  data = static_cast<char *>(map);
+}
+
+
+//
+// Unmaps and closes the file.
+//
+MappedFile::~MappedFile (void)
+{
+  if (data)
+    munmap(data, size);
+
+  if (fd != -1)
+    close(fd);
+}
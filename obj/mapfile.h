@@ -0,0 +1,47 @@
+//
+// mapfile.h
+//
+// A read-only memory mapping of a whole file. The contents can be scanned in
+// place without being copied into a buffer first.
+//
+
+#ifndef _MAPFILE_H_
+#define _MAPFILE_H_
+
+
+#include <string>
+#include <cstddef>
+using std::string;
+
+
+class MappedFile
+{
+
+private:
+
+  int fd;
+  char *data;
+  size_t size;
+
+  // Mappings can't be shared between copies.
+  MappedFile (const MappedFile&);
+  MappedFile& operator= (const MappedFile&);
+
+public:
+
+  MappedFile (const string& filename);
+  ~MappedFile (void);
+
+  bool isOpen (void) const
+  { return fd != -1; }
+
+  const char *getData (void) const
+  { return data; }
+
+  const size_t& getSize (void) const
+  { return size; }
+
+};
+
+
+#endif // _MAPFILE_H_
@@ -3,25 +3,37 @@
 //
 
 #include "obj.h"
+#include "mapfile.h"
 #include "../material/texture.h"
 
 #include <string>
 #include <cstdio>
-#include <cfloat>
+#include <cstring>
 #include <stdexcept>
+#include <sys/time.h>
+#include <sys/stat.h>
 
 
-#ifndef MIN
-#  define MIN(a,b) (a > b ? b : a)
-#endif
-#ifndef MAX
-#  define MAX(a,b) (a > b ? a : b)
-#endif
+// The parser and scanner are reentrant, all of their state lives in the
+// scanner handle so several files can be parsed at once.
+typedef void *yyscan_t;
 
+int yyparse(yyscan_t scanner, ObjModel *objFile, ObjLoadData *ld);
+int yylex_init(yyscan_t *scanner);
+int yylex_destroy(yyscan_t scanner);
+void yyset_in(FILE *in, yyscan_t scanner);
+int yyget_lineno(yyscan_t scanner);
 
-int yyparse(ObjModel *objFile);
-extern FILE *yyin;
-extern int yylineno;
+
+//
+// Wall clock time in seconds, for reporting load speeds.
+//
+static double getTime (void)
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
 
 
 // --------------------------------------------------------------------------
@@ -41,11 +53,13 @@ NamedObject::NamedObject( const string& name, const int& index )
 // --------------------------------------------------------------------------
 
 
-ObjModel::ObjModel(const string& filename)
-  : filename(filename), faceVertNo(0)
+ObjModel::ObjModel(const string& filename, const ObjParser& parser,
+    const bool& useCache)
+  : faceVertNo(0), filename(filename), buildProxies(true),
+    weldTolerance(0.0f)
 {
   if(filename != "")
-    loadFile(filename);
+    loadFile(filename, parser, useCache);
 }
 
 
@@ -54,45 +68,111 @@ ObjModel::~ObjModel()
 
 
 //
-// The parsing of the OBJ file is started with this function.
+// The parsing of the OBJ file is started with this function. Returns 0 on
+// success. The time taken to parse the file is reported in MB/s.
 //
-int ObjModel::loadFile(const string& filename)
+// Unless useCache is false, a precooked .smesh file next to the OBJ is used
+// instead if it is up to date, and is written out after parsing otherwise.
+//
+int ObjModel::loadFile(const string& filename, const ObjParser& parser,
+    const bool& useCache)
 {
+  this->filename = filename;
+
+  // The cache is stale if the OBJ has changed since it was written. Without
+  // an OBJ at all, any cache is taken as it is.
+  struct stat st;
+  long long sourceSize = -1, sourceTime = -1;
+
+  if (stat(filename.c_str(), &st) == 0)
+  {
+    sourceSize = st.st_size;
+    sourceTime = st.st_mtime;
+  }
+
+  string cache = getCachePath(filename);
+
+  if (useCache)
+  {
+    double start = getTime();
+
+    if (loadCache(cache, sourceSize, sourceTime))
+    {
+      printf("%s: loaded from %s in %.3fs.\n", filename.c_str(),
+          cache.c_str(), getTime() - start);
+      return 0;
+    }
+  }
+
   ObjLoadData *ld = new ObjLoadData();
-  
-  yyin = fopen(filename.c_str(), "rt");
-  int result = yyparse(this, ld);
+
+  int result = 1;
+  long bytes = 0;
+  double start = getTime();
+
+  if (parser == OBJ_BISON)
+  {
+    FILE *in = fopen(filename.c_str(), "rt");
+    yyscan_t scanner;
+
+    if (in && yylex_init(&scanner) == 0)
+    {
+      yyset_in(in, scanner);
+      result = yyparse(scanner, this, ld);
+      yylex_destroy(scanner);
+
+      fseek(in, 0, SEEK_END);
+      bytes = ftell(in);
+    }
+
+    if (in)
+      fclose(in);
+  }
+  else
+  {
+    MappedFile file(filename);
+    if (file.isOpen())
+    {
+      bytes = file.getSize();
+      result = scanFile(file.getData(), file.getSize(), *ld);
+    }
+  }
+
+  double parseTime = getTime() - start;
+
+  if (bytes == 0 && result != 0)
+    fprintf(stderr, "Unable to open %s\n", filename.c_str());
 
   postProcessModel(*ld);
 
   delete ld;
 
+  printf("%s: %.2f MB parsed in %.3fs (%.1f MB/s) with the %s parser.\n",
+      filename.c_str(), bytes / 1048576.0, parseTime,
+      parseTime > 0.0 ? bytes / 1048576.0 / parseTime : 0.0,
+      parser == OBJ_BISON ? "bison" : "mapped");
+
+  if (useCache && result == 0 && sourceSize >= 0 &&
+      !saveCache(cache, sourceSize, sourceTime))
+    printf("%s: unable to write %s.\n", filename.c_str(), cache.c_str());
+
   return result;
 }
 
 
 //
-// Sets the values of the two referenced vectors to the min and max corners
-// of an axis aligned BoundingBox.
+// The cache for an OBJ file sits next to it, with .smesh in place of the
+// .obj extension.
 //
-void ObjModel::findBoundingBox(Vec3 &min, Vec3 &max) const
+string ObjModel::getCachePath(const string& filename)
 {
-  for(int i = 0; i < 3; i++)
-  {
-    min.x = min.y = min.z = FLT_MAX;
-    max.x = max.y = max.z = -FLT_MAX;
-  }
+  string::size_type dot = filename.rfind('.');
+  string::size_type slash = filename.rfind('/');
 
-  for(vector<Vec3>::const_iterator it = vertArray.begin();
-      it != vertArray.end(); ++it)
-  {
-    min.x = MIN(min.x, it->x);
-    min.y = MIN(min.y, it->y);
-    min.z = MIN(min.z, it->z);
-    max.x = MAX(max.x, it->x);
-    max.y = MAX(max.y, it->y);
-    max.z = MAX(max.z, it->z);
-  }
+  if (dot == string::npos || (slash != string::npos && dot < slash))
+    return filename + ".smesh";
+
+  return filename.substr(0, dot) + ".smesh";
 }
 
 
@@ -110,14 +190,41 @@ void ObjModel::beginFace(void)
 
 
 //
-// Adds a new vertex to the current face. 
+// Adds a new vertex to the current face. Faces with more than three vertices
+// are split into a fan of triangles around their first vertex, the same as
+// the mapped scanner.
 //
 void ObjModel::addFaceVertex(const int& vIndex, const int& tIndex,
       const int& nIndex, const ObjLoadData& ld)
 {
+  if (faceVertNo == 3)
+  {
+    int first[3] = { polyFirst[0], polyFirst[1], polyFirst[2] };
+    int last[3]  = { polyLast[0], polyLast[1], polyLast[2] };
+
+    beginFace();
+    addFaceVertex(first[0], first[1], first[2], ld);
+    addFaceVertex(last[0], last[1], last[2], ld);
+  }
+
+  if (faceVertNo == 0)
+  {
+    polyFirst[0] = vIndex;
+    polyFirst[1] = tIndex;
+    polyFirst[2] = nIndex;
+  }
+
+  polyLast[0] = vIndex;
+  polyLast[1] = tIndex;
+  polyLast[2] = nIndex;
+
   int fIndex = faceArray.size();
 
-  faceArray[fIndex - 1].index[faceVertNo] = vIndex - 1;
+  // Relative indexes count back from the last vertex read so far.
+  if (vIndex < 0)
+    faceArray[fIndex - 1].index[faceVertNo] = ld.vertices.size() + vIndex;
+  else
+    faceArray[fIndex - 1].index[faceVertNo] = vIndex - 1;
 
   if (vIndex < 0)
     addVertex(ld.vertices[ld.vertices.size() + vIndex]);
@@ -140,80 +247,43 @@ void ObjModel::addFaceVertex(const int& vIndex, const int& tIndex,
 
 //
 // Processes the model after all vertex and face data has been loaded.
-// Calcualtes the edges in a uniform orientation and solves all the
-// face normals.
+// Calcualtes the edges in a uniform orientation (see Model::buildEdges),
+// indexes the vertices and solves all the face normals.
 //
 void ObjModel::postProcessModel(ObjLoadData& ld)
 {
-  int vCount = ld.vertices.size();
-  int edgeCount = 0;
   realVerts = ld.vertices;
 
   hasNormals   = (normArray.size() > 0);
   hasTexCoords = (textArray.size() > 0);
 
-  // Allocate edge memory and clear the array of indexes.
-  int *edgeRef = new int[SQ(vCount)];
-  for (int i = 0; i < SQ(vCount); i++)
-    edgeRef[i] = -1;
+  // Keep faces near each other together for the silhouette clusters, then
+  // match up the faces on either side of every edge.
+  clusterFaces();
+  buildEdges();
 
-  for (int it = 0; it < faceArray.size(); it++)
+  // Exporters often repeat a position along texture and normal seams, which
+  // leaves the seam open. Welding closes it for the shadows, the edges are
+  // only built again if anything was welded.
+  if (weldTolerance > 0.0f)
   {
-    Face& face = faceArray[it];
-
-    // ----------------------------------------------------------------------
-    // Edge Detection - Phase 1
-    //
-    // Loop through all triangles. The vertices are already ordered properly
-    // for OpenGL drawing. So what we're going to do is add a new edge if
-    // the first index is less than the second one ONLY. This will ensure
-    // that each edge is only added once.
-    // ----------------------------------------------------------------------
-    for(int i = 0; i < 3; i++)
-    {
-      int ni = (i + 1) % 3;
+    int edges = edgeArray.size();
+    int collapsed;
+    int welded = weldPositions(weldTolerance, collapsed);
 
-      int i1 = face.index[i];
-      int i2 = face.index[ni];
-      
-      if (i1 < i2)
-      {
-        Edge e(i1, i2, it, this);
-        edgeArray.push_back(e);
-        edgeRef[i1 * vCount + i2] = edgeArray.size() - 1;
-      }
-    }
+    if (welded > 0)
+      buildEdges();
+
+    printf("%s: welded %d vertices, %d fewer edges, %d faces collapsed.\n",
+        filename.c_str(), welded, edges - (int) edgeArray.size(), collapsed);
   }
 
-  for (int it = 0; it < faceArray.size(); it++)
+  if (boundaryEdges > 0 || nonManifoldEdges > 0)
   {
-    Face& face = faceArray[it];
-
-    // ----------------------------------------------------------------------
-    // Edge Detection - Phase 2
-    //
-    // Now that we have an edge for every vertex pair, all we need to do is
-    // find the opposite; every edge pair which the first index is larger
-    // than the second, and fill in the missing face pointer.
-    // ----------------------------------------------------------------------
-    for(int i = 0; i < 3; i++)
-    {
-      int ni = (i + 1) % 3;
-
-      int i1 = face.index[i];
-      int i2 = face.index[ni];
-      
-      if (i1 > i2)
-      {
-        int thisEdge = edgeRef[i2 * vCount + i1];
-        edgeArray[thisEdge].addSecondFace(it);
-      }
-    }
-
+    printf("%s: %d boundary and %d non-manifold edges.\n", filename.c_str(),
+        boundaryEdges, nonManifoldEdges);
   }
 
-  delete [] edgeRef;
-
 
   //
   // Normal calculations if a model does NOT include any normal data. This
@@ -241,7 +311,49 @@ void ObjModel::postProcessModel(ObjLoadData& ld)
     hasNormals = true;
   }
 
+  // Share vertices between faces wherever the position, texture coordinate
+  // and normal all match.
+  int corners = vertArray.size();
+  indexVertices();
+
+  printf("%s: %d face corners share %d vertices.\n", filename.c_str(),
+      corners, (int) vertArray.size());
+
   calcFaceNormals();
+
+  silhouetteData.build(*this);
+
+  printf("%s: %d of %d edges can be on a silhouette.\n", filename.c_str(),
+      (int) silhouetteData.candidateEdges.size(), (int) edgeArray.size());
+
+  if (silhouetteData.convex)
+    printf("%s: closed and convex.\n", filename.c_str());
+
+  if (buildProxies)
+    makeShadowProxies();
+}
+
+
+//
+// Builds the simplified copies of the model that its shadows are cast from,
+// see Model::buildShadowProxies(). They are kept in the cache with the rest
+// of the model.
+//
+void ObjModel::makeShadowProxies(void)
+{
+  double start = getTime();
+  buildShadowProxies();
+
+  for (int i = 0; i < shadowProxies.size(); i++)
+  {
+    printf("%s: shadow proxy of %d faces, within %.4f of the surface.\n",
+        filename.c_str(), shadowProxies[i].model->faceCount(),
+        shadowProxies[i].error);
+  }
+
+  if (shadowProxies.size() > 0)
+    printf("%s: shadow proxies made in %.3fs.\n", filename.c_str(),
+        getTime() - start);
 }
 
 void ObjModel::useTexture(const char *file)
@@ -249,21 +361,22 @@ void ObjModel::useTexture(const char *file)
   if (strlen(file) > 0)
   {
     string str(file);
+    textureName = str;
     
     str = "data/textures/" + str + ".png";
 
     printf("Model using texture: %s\n", str.c_str());
     
-    tex = new Texture();
-    tex->loadTexture(str.c_str());
+    textureFile = str;
   }
 }
 
 //
 // Main error function that will be called in case of a parse error.
 //
-void yyerror(ObjModel *objFile, ObjLoadData *ld, const char *s)
+void yyerror(yyscan_t scanner, ObjModel *objFile, ObjLoadData *ld,
+    const char *s)
 {
-  fprintf(stderr, "%d: %s\n", yylineno, s);
+  fprintf(stderr, "%d: %s\n", yyget_lineno(scanner), s);
 }
 
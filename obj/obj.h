@@ -48,6 +48,17 @@ public:
   Face *edgeRef;
 };
 
+//
+// The parsers available to ObjModel::loadFile. The bison grammar is kept
+// around so the output of the two can be compared.
+//
+enum ObjParser
+{
+  OBJ_BISON,                    // flex/bison grammar in grammar.y.
+  OBJ_MAPPED                    // In place scanner in objscan.cpp.
+};
+
+
 //
 // An OBJ loading Model class.
 //
@@ -56,12 +67,23 @@ class ObjModel : public Model
 
 public:
 
-  ObjModel(const string& filename = "");
+  ObjModel(const string& filename = "",
+      const ObjParser& parser = OBJ_MAPPED, const bool& useCache = true);
   virtual ~ObjModel(void);
 
-  int loadFile(const string& filename);
+  int loadFile(const string& filename, const ObjParser& parser = OBJ_MAPPED,
+      const bool& useCache = true);
 
-  void findBoundingBox(Vec3 &min, Vec3 &max) const;
+  static string getCachePath(const string& filename);
+
+  // Shadow proxies are made by loadFile() unless this is turned off first.
+  void setBuildProxies(const bool& build)
+  { buildProxies = build; }
+
+  // Real vertices closer than this are welded together by loadFile(), see
+  // Model::weldPositions(). Zero, the default, leaves them as they are.
+  void setWeldTolerance(const float& tolerance)
+  { weldTolerance = tolerance; }
 
 protected:
 
@@ -74,15 +96,30 @@ protected:
   
   void postProcessModel (ObjLoadData& ld);
 
+  void makeShadowProxies (void);
+
+  int scanFile (const char *data, const size_t& size, ObjLoadData& ld);
+
+  // Precooked .smesh cache, see smesh.cpp.
+  bool loadCache (const string& path, const long long& sourceSize,
+      const long long& sourceTime);
+  bool saveCache (const string& path, const long long& sourceSize,
+      const long long& sourceTime) const;
+
   int faceVertNo;
+  int polyFirst[3], polyLast[3];  // Corners the next fan triangle shares.
 
   void useTexture(const char *file);
 
 private:
 
   string filename;
+  string textureName;
+
+  bool buildProxies;
+  float weldTolerance;
 
-  friend int yyparse(ObjModel *objModel, ObjLoadData *ld);
+  friend int yyparse(void *scanner, ObjModel *objModel, ObjLoadData *ld);
 
 };
 
@@ -0,0 +1,1039 @@
+//
+// objbench.cpp
+//
+// Loading benchmark. Writes out synthetic OBJ meshes (a closed torus made of
+// a grid of quads) of increasing size, loads them through ObjModel with both
+// parsers and times the loads and the edge matching on their own. The output
+// of the two parsers is compared as well, on those and on a file using every
+// other statement they accept. Not a part of the final executable.
+//
+// Afterwards the silhouette kernels are timed against the original per Face
+// and per Edge loop, on the given models and a 1M face torus, then the
+// incremental updates against full searches for a slowly moving light, and
+// the shared directional silhouettes against searching for every instance.
+// Then the cluster tree is timed against searching every face and edge, on
+// tori of increasing size. Then the silhouette walk for convex models is
+// timed against testing every edge, on spheres of increasing size. Last,
+// shadow proxies are made for tori of increasing size, and finding
+// silhouettes on each is timed against the torus itself. Every other table
+// loads its models without proxies.
+//
+// Exits with EXIT_FAILURE if the parsers, SIMD kernels, incremental
+// updates, cluster tree or convex walk disagree with their reference, or a
+// proxy isn't closed.
+//
+// Usage: objbench [max triangles] [models...]
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#include "obj.h"
+
+
+using namespace std;
+
+
+static const char *BENCH_FILE = "/tmp/objbench.obj";
+
+static const char *DEFAULT_MODELS[] = { "../data/models/torus.obj",
+  "../data/models/ring.obj" };
+
+// Light positions each silhouette method is timed over.
+static const int LIGHT_COUNT = 64;
+
+// Frames the slowly moving light is followed for, and how far it moves in
+// each as a fraction of the model's size.
+static const int FRAME_COUNT = 256;
+static const float FRAME_STEP = 0.002f;
+static const float NEAR_RANGE = 0.05f;
+
+// Instances of a model lit by a slowly turning sun, in this many different
+// orientations, and how far the sun turns each frame in radians.
+static const int INSTANCE_COUNT = 16;
+static const int ORIENTATION_COUNT = 4;
+static const float SUN_STEP = 0.001f;
+
+// Sizes of the tori the cluster tree is timed on.
+static const int CLUSTER_SIZES[] = { 50000, 250000, 1000000, 4000000 };
+
+// Sizes of the spheres the convex silhouette walk is timed on.
+static const int CONVEX_SIZES[] = { 1000, 10000, 100000, 1000000 };
+
+// Vertices in the parser parity file, see writeSyntaxObj().
+static const int SYNTAX_VERTICES = 20000;
+
+// Sizes of the tori shadow proxies are made for.
+static const int PROXY_SIZES[] = { 10000, 100000, 1000000 };
+
+
+//
+// Wall clock time in seconds.
+//
+static double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+//
+// Fills a model with a torus of roughly the requested number of triangles.
+// Every vertex is shared by six faces and every edge by two, so the mesh is
+// closed.
+//
+static void makeTorus(Model& model, const int& triangles)
+{
+  int nu = (int) sqrt(triangles / 2.0);
+  int nv = triangles / (2 * nu);
+
+  model.realVerts.clear();
+  model.faceArray.clear();
+
+  for (int i = 0; i < nu; i++)
+  {
+    float u = 2.0f * M_PI * i / nu;
+
+    for (int j = 0; j < nv; j++)
+    {
+      float v = 2.0f * M_PI * j / nv;
+      float r = 3.0f + cos(v);
+
+      model.realVerts.push_back(Vec3(r * cos(u), sin(v), r * sin(u)));
+    }
+  }
+
+  for (int i = 0; i < nu; i++)
+  {
+    for (int j = 0; j < nv; j++)
+    {
+      int a = i * nv + j;
+      int b = ((i + 1) % nu) * nv + j;
+      int c = ((i + 1) % nu) * nv + (j + 1) % nv;
+      int d = i * nv + (j + 1) % nv;
+
+      Face f1, f2;
+      f1.index[0] = a; f1.index[1] = b; f1.index[2] = c;
+      f2.index[0] = c; f2.index[1] = d; f2.index[2] = a;
+      f1.vStart = f2.vStart = 0;
+
+      model.faceArray.push_back(f1);
+      model.faceArray.push_back(f2);
+    }
+  }
+}
+
+
+//
+// Fills a model with a sphere of roughly the requested number of triangles,
+// in rings of quads with a fan of triangles at each pole. The quads are
+// flat, so the sphere is convex.
+//
+static void makeSphere(Model& model, const int& triangles)
+{
+  int nu = (int) sqrt((double) triangles);
+  int nv = triangles / (2 * nu) + 1;
+
+  model.realVerts.clear();
+  model.faceArray.clear();
+
+  model.realVerts.push_back(Vec3(0.0f, 1.0f, 0.0f));
+
+  for (int j = 1; j < nv; j++)
+  {
+    float v = M_PI * j / nv;
+
+    for (int i = 0; i < nu; i++)
+    {
+      float u = 2.0f * M_PI * i / nu;
+      model.realVerts.push_back(Vec3(sin(v) * cos(u), cos(v),
+            sin(v) * sin(u)));
+    }
+  }
+
+  int bottom = model.realVerts.size();
+  model.realVerts.push_back(Vec3(0.0f, -1.0f, 0.0f));
+
+  Face f;
+  f.vStart = 0;
+
+  for (int i = 0; i < nu; i++)
+  {
+    int next = (i + 1) % nu;
+
+    f.index[0] = 0; f.index[1] = 1 + next; f.index[2] = 1 + i;
+    model.faceArray.push_back(f);
+
+    for (int j = 1; j < nv - 1; j++)
+    {
+      int a = 1 + (j - 1) * nu + i;
+      int b = 1 + (j - 1) * nu + next;
+      int c = b + nu;
+      int d = a + nu;
+
+      f.index[0] = a; f.index[1] = b; f.index[2] = c;
+      model.faceArray.push_back(f);
+      f.index[0] = c; f.index[1] = d; f.index[2] = a;
+      model.faceArray.push_back(f);
+    }
+
+    int last = 1 + (nv - 2) * nu;
+    f.index[0] = bottom; f.index[1] = last + i; f.index[2] = last + next;
+    model.faceArray.push_back(f);
+  }
+}
+
+
+//
+// Writes the faces and vertices of a model out as an OBJ file.
+//
+static void writeObj(const Model& model, const char *path)
+{
+  FILE *out = fopen(path, "wt");
+  if (!out)
+  {
+    fprintf(stderr, "Unable to write %s\n", path);
+    exit(1);
+  }
+
+  for (int i = 0; i < model.realVerts.size(); i++)
+  {
+    const Vec3& v = model.realVerts[i];
+    fprintf(out, "v %f %f %f\n", v.x, v.y, v.z);
+  }
+
+  for (int i = 0; i < model.faceArray.size(); i++)
+  {
+    const Face& f = model.faceArray[i];
+    fprintf(out, "f %d %d %d\n", f.index[0] + 1, f.index[1] + 1,
+        f.index[2] + 1);
+  }
+
+  fclose(out);
+}
+
+
+//
+// Writes an OBJ file using the statements the synthetic meshes don't:
+// texture coordinates, normals, polygons, relative indexes, integer,
+// long and exponent coordinates, and lines both parsers skip. Both parsers
+// have to load it the same.
+//
+static void writeSyntaxObj(const char *path)
+{
+  FILE *out = fopen(path, "wt");
+  if (!out)
+  {
+    fprintf(stderr, "Unable to write %s\n", path);
+    exit(1);
+  }
+
+  fprintf(out, "# Parser parity test\nmtllib test.mtl\no test\n");
+  srand(1);
+
+  const int count = SYNTAX_VERTICES;
+  for (int i = 0; i < count; i++)
+  {
+    double x[3];
+    for (int j = 0; j < 3; j++)
+      x[j] = (rand() / (double) RAND_MAX - 0.5) *
+        pow(10.0, rand() % 41 - 20);
+
+    // The first is just over halfway between two floats, but a double
+    // rounds it down to exactly halfway. Then the smallest denormal and
+    // the largest float.
+    if (i == 0)
+      fprintf(out, "v 1.00000005960464477550 1.4e-45 -3.40282347e+38\n");
+    else switch (i % 4)
+    {
+      case 0:
+        fprintf(out, "v %.9g %.9g %.9g\n", x[0], x[1], x[2]);
+        break;
+      case 1:
+        fprintf(out, "  v %.17g %.17g %.17g # long\n", x[0], x[1], x[2]);
+        break;
+      case 2:
+        fprintf(out, "v %.8e %.8E %.3e\n", x[0], x[1], x[2]);
+        break;
+      default:
+        fprintf(out, "v %d %d %d\n", rand() % 2001 - 1000,
+            rand() % 2001 - 1000, rand() % 2001 - 1000);
+    }
+
+    fprintf(out, "vt %.7f %.7f\nvn %.8f %.8f %.8f\n",
+        rand() / (double) RAND_MAX, rand() / (double) RAND_MAX,
+        x[0], x[1], x[2]);
+  }
+
+  fprintf(out, "g polygons\ns 1\nusemtl test\n");
+
+  // Triangles, quads and pentagons, with absolute and relative indexes.
+  // Every corner has a texture coordinate and normal, as a model can't mix
+  // corners with and without them.
+  for (int i = 0, sides = 3; i + sides <= count; i += sides)
+  {
+    fprintf(out, "f");
+    for (int k = 0; k < sides; k++)
+    {
+      int v = i + k + 1;
+      int r = v - count - 1;
+      switch ((i + k) % 3)
+      {
+        case 0: fprintf(out, " %d/%d/%d", v, v, v); break;
+        case 1: fprintf(out, " %d/%d/%d", r, r, r); break;
+        default: fprintf(out, " %d/%d/%d", r, v, r);
+      }
+    }
+    fprintf(out, "\n");
+
+    if (i % 50 == 0)
+      fprintf(out, "s off\ng group%d\n", i);
+
+    sides = 3 + (sides - 2) % 3;
+  }
+
+  fclose(out);
+}
+
+
+//
+// True if both arrays hold exactly the same vectors.
+//
+static bool sameArray(const vector<Vec3>& a, const vector<Vec3>& b)
+{
+  if (a.size() != b.size())
+    return false;
+
+  for (int i = 0; i < a.size(); i++)
+    for (int j = 0; j < 4; j++)
+      if (a[i].v[j] != b[i].v[j])
+        return false;
+
+  return true;
+}
+
+
+//
+// True if both models hold exactly the same loaded data.
+//
+static bool sameModel(const ObjModel& a, const ObjModel& b)
+{
+  if (!sameArray(a.vertArray, b.vertArray) ||
+      !sameArray(a.textArray, b.textArray) ||
+      !sameArray(a.normArray, b.normArray) ||
+      a.faceArray.size() != b.faceArray.size())
+    return false;
+
+  for (int i = 0; i < a.faceArray.size(); i++)
+    for (int j = 0; j < 3; j++)
+      if (a.faceArray[i].index[j] != b.faceArray[i].index[j])
+        return false;
+
+  return true;
+}
+
+
+//
+// LIGHT_COUNT lights circling a model at distance r, bobbing up and down as
+// they go. Every directionalEvery'th one is directional instead, or none
+// are if it is 0.
+//
+static void makeLightRing(const float& r, const int& directionalEvery,
+    vector<Vec3>& lights)
+{
+  lights.clear();
+
+  for (int i = 0; i < LIGHT_COUNT; i++)
+  {
+    float a = 2.0f * M_PI * i / LIGHT_COUNT;
+    bool directional = directionalEvery > 0 &&
+      i % directionalEvery == directionalEvery - 1;
+
+    lights.push_back(Vec3(r * cos(a), 0.5f * r * sin(3.0f * a), r * sin(a),
+          directional ? 0.0f : 1.0f));
+  }
+}
+
+
+//
+// The light facing test and silhouette loop as they were before the SIMD
+// kernels, with a flag in every face and a branch for every edge. Kept here
+// to compare against.
+//
+struct OldFace
+{
+  Vec3 normal;
+  int index[3];
+  bool lightFacing;
+};
+
+
+static void oldSilhouette(const Model& model, vector<OldFace>& faces,
+    const Vec3& lightPos, vector<Edge>& silhouette, vector<int> *codes)
+{
+  silhouette.clear();
+
+  for (vector<OldFace>::iterator it = faces.begin(); it != faces.end(); ++it)
+  {
+    it->lightFacing = dot(it->normal,
+        lightPos.w * model.realVerts[it->index[0]] - lightPos) > 0.0001f;
+  }
+
+  for (EdgeArray::const_iterator edge = model.edgeArray.begin();
+      edge != model.edgeArray.end(); ++edge)
+  {
+    bool lf1 = edge->f2 != -1 && faces[edge->f2].lightFacing;
+    bool lf2 = faces[edge->f1].lightFacing;
+
+    if ((lf1 && !lf2) || (!lf1 && lf2))
+    {
+      Edge e = *edge;
+      silhouette.push_back(lf1 ? e : e.reverse());
+
+      // The same (edge * 2 + reversed) form as findSilhouetteEdges().
+      if (codes)
+        codes->push_back((edge - model.edgeArray.begin()) * 2 + !lf1);
+    }
+  }
+}
+
+
+//
+// Times finding the silhouette of a model with the old loop and each of the
+// kernels the CPU supports, for lights circling the model. Both sides build
+// the final EdgeArray the same way Caster does. Kernels which don't give
+// exactly the old silhouette are flagged with a '*', they can differ on
+// faces right at the threshold. Neighbouring faces in the same plane are
+// given exactly the same one, so the old loop can also find edges between
+// them which the kernels leave out.
+//
+// The SSE and AVX2 kernels have to give exactly the light facing faces and
+// edges of the plain one, any which don't are flagged with a '!'. Returns
+// false if one was.
+//
+static bool benchSilhouette(const char *name, const ObjModel& model)
+{
+  vector<OldFace> faces(model.faceArray.size());
+  for (int i = 0; i < faces.size(); i++)
+  {
+    faces[i].normal = model.faceArray[i].normal;
+    for (int j = 0; j < 3; j++)
+      faces[i].index[j] = model.faceArray[i].index[j];
+  }
+
+  Vec3 min, max;
+  model.findBoundingBox(min, max);
+  float r = (max - min).mag() + 1.0f;
+
+  vector<Vec3> lights;
+  makeLightRing(r, 0, lights);
+
+  vector<vector<int> > expected(LIGHT_COUNT);
+  vector<Edge> silhouette;
+
+  for (int i = 0; i < LIGHT_COUNT; i++)
+    oldSilhouette(model, faces, lights[i], silhouette, &expected[i]);
+
+  double start = now();
+  for (int i = 0; i < LIGHT_COUNT; i++)
+    oldSilhouette(model, faces, lights[i], silhouette, NULL);
+  double oldTime = (now() - start) / LIGHT_COUNT;
+  double bestTime = oldTime;
+  bool allAgree = true;
+
+  printf("%-24s %9d %10.1f", name, model.faceCount(), oldTime * 1e6);
+
+  const SilhouetteSimd simd = getSilhouetteSimd();
+  const SilhouetteSimd simds[] = { SIMD_NONE, SIMD_SSE, SIMD_AVX2 };
+
+  vector<vector<uint> > plainFacing(LIGHT_COUNT);
+  vector<vector<int> > plain(LIGHT_COUNT);
+
+  setSilhouetteSimd(SIMD_NONE);
+  for (int i = 0; i < LIGHT_COUNT; i++)
+  {
+    findLightFacing(model.silhouetteData, lights[i], plainFacing[i]);
+    findSilhouetteEdges(model.silhouetteData, plainFacing[i], plain[i]);
+  }
+
+  for (int s = 0; s < 3; s++)
+  {
+    if (!setSilhouetteSimd(simds[s]))
+    {
+      printf(" %10s  ", "-");
+      continue;
+    }
+
+    vector<uint> facing;
+    vector<int> edges;
+    bool same = true, agrees = true;
+
+    start = now();
+    for (int i = 0; i < LIGHT_COUNT; i++)
+    {
+      findLightFacing(model.silhouetteData, lights[i], facing);
+      findSilhouetteEdges(model.silhouetteData, facing, edges);
+
+      silhouette.clear();
+      for (int j = 0; j < edges.size(); j++)
+      {
+        Edge e = model.edgeArray[edges[j] >> 1];
+        silhouette.push_back((edges[j] & 1) ? e.reverse() : e);
+      }
+
+      same = same && edges == expected[i];
+      agrees = agrees && edges == plain[i] && facing == plainFacing[i];
+    }
+    double time = (now() - start) / LIGHT_COUNT;
+
+    if (time < bestTime)
+      bestTime = time;
+
+    printf(" %10.1f%s", time * 1e6, !agrees ? " !" : same ? "  " : " *");
+    allAgree = allAgree && agrees;
+  }
+
+  setSilhouetteSimd(simd);
+  printf(" %7.1fx\n", oldTime / bestTime);
+
+  return allAgree;
+}
+
+
+//
+// Follows a light moving a little every frame, finding the silhouette from
+// scratch each frame and updating it the way Caster does. Both have to give
+// the same edges (in a different order) and the same light facing faces.
+// The light is searched from scratch again once it has moved NEAR_RANGE.
+// Returns false if they ever differ.
+//
+static bool benchIncremental(const char *name, const ObjModel& model)
+{
+  const SilhouetteData& data = model.silhouetteData;
+
+  Vec3 min, max;
+  model.findBoundingBox(min, max);
+  float size = (max - min).mag();
+  float r = size + 1.0f;
+
+  vector<Vec3> lights;
+  for (int i = 0; i < FRAME_COUNT; i++)
+  {
+    float a = FRAME_STEP * size / r * i;
+    lights.push_back(Vec3(r * cos(a), 0.5f * r * sin(3.0f * a), r * sin(a),
+          1.0f));
+  }
+
+  vector<vector<int> > expected(FRAME_COUNT);
+  vector<vector<uint> > expectedFacing(FRAME_COUNT);
+
+  double start = now();
+  for (int i = 0; i < FRAME_COUNT; i++)
+  {
+    findLightFacing(data, lights[i], expectedFacing[i]);
+    findSilhouetteEdges(data, expectedFacing[i], expected[i]);
+  }
+  double fullTime = (now() - start) / FRAME_COUNT;
+
+  vector<uint> facing;
+  vector<int> edges, slots;
+  vector<NearFace> near;
+  float range = NEAR_RANGE * data.radius;
+  float moved = range + 1.0f;
+  int searches = 0, flipped = 0;
+  bool same = true;
+
+  vector<double> times(FRAME_COUNT);
+  for (int i = 0; i < FRAME_COUNT; i++)
+  {
+    start = now();
+
+    if (i > 0)
+      moved += (lights[i] - lights[i - 1]).mag();
+
+    if (moved <= range)
+      flipped += updateSilhouette(data, lights[i], moved, near, facing,
+          edges, slots);
+    else
+    {
+      findLightFacing(data, lights[i], facing);
+      findSilhouetteEdges(data, facing, edges);
+      findNearFaces(data, lights[i], range, near);
+      findEdgeSlots(data, edges, slots);
+      moved = 0.0f;
+      searches++;
+    }
+
+    times[i] = now() - start;
+
+    vector<int> sorted = edges;
+    std::sort(sorted.begin(), sorted.end());
+    same = same && sorted == expected[i] && facing == expectedFacing[i];
+  }
+
+  // The median hides the frames where everything is searched again.
+  vector<double> sortedTimes = times;
+  std::sort(sortedTimes.begin(), sortedTimes.end());
+  double total = 0.0;
+  for (int i = 0; i < FRAME_COUNT; i++)
+    total += times[i];
+
+  printf("%-24s %9d %10d %10.1f %10.1f %10.1f %8d %8d %5s\n", name,
+      model.faceCount(), (int) near.size(), fullTime * 1e6,
+      sortedTimes[FRAME_COUNT / 2] * 1e6, total / FRAME_COUNT * 1e6,
+      searches, flipped, same ? "yes" : "NO");
+
+  return same;
+}
+
+
+//
+// Follows a directional light turning slowly over many instances of a
+// model, some sharing an orientation. Every instance is searched from
+// scratch each frame, then looked up in the model's DirectionalSilhouettes
+// the way Caster does. Lookups are for the middle of the light's bin, so
+// some faces right on the silhouette can differ, shown as a percentage of
+// the faces.
+//
+static void benchDirectional(const char *name, const ObjModel& model)
+{
+  const SilhouetteData& data = model.silhouetteData;
+  data.directional.clear();
+
+  vector<vector<Vec3> > lights(FRAME_COUNT, vector<Vec3>(INSTANCE_COUNT));
+  for (int i = 0; i < FRAME_COUNT; i++)
+  {
+    float a = 0.3f + SUN_STEP * i;
+    Vec3 sun(cos(a), -1.0f, sin(a), 0.0f);
+
+    // Each orientation is turned about the y axis.
+    for (int j = 0; j < INSTANCE_COUNT; j++)
+    {
+      float t = 2.0f * M_PI * (j % ORIENTATION_COUNT) / ORIENTATION_COUNT;
+      lights[i][j] = Vec3(sun.x * cos(t) - sun.z * sin(t), sun.y,
+          sun.x * sin(t) + sun.z * cos(t), 0.0f);
+    }
+  }
+
+  vector<vector<uint> > expectedFacing(INSTANCE_COUNT);
+  vector<vector<int> > expected(INSTANCE_COUNT);
+
+  double start = now();
+  for (int i = 0; i < FRAME_COUNT; i++)
+  {
+    for (int j = 0; j < INSTANCE_COUNT; j++)
+    {
+      findLightFacing(data, lights[i][j], expectedFacing[j]);
+      findSilhouetteEdges(data, expectedFacing[j], expected[j]);
+    }
+  }
+  double fullTime = (now() - start) / FRAME_COUNT;
+
+  vector<uint> facing;
+  vector<int> edges;
+  long differ = 0;
+
+  double lookupTime = 0.0;
+  for (int i = 0; i < FRAME_COUNT; i++)
+  {
+    for (int j = 0; j < INSTANCE_COUNT; j++)
+    {
+      start = now();
+      data.directional.lookup(data, lights[i][j], facing, edges);
+      lookupTime += now() - start;
+
+      // Only the last frame's exact answers are kept.
+      if (i == FRAME_COUNT - 1)
+      {
+        for (int k = 0; k < facing.size(); k++)
+          differ += __builtin_popcount(facing[k] ^ expectedFacing[j][k]);
+      }
+    }
+  }
+  lookupTime /= FRAME_COUNT;
+
+  printf("%-24s %9d %10d %10.1f %10.1f %8.1fx %7.3f%%\n", name,
+      model.faceCount(), INSTANCE_COUNT, fullTime * 1e6, lookupTime * 1e6,
+      fullTime / lookupTime,
+      100.0 * differ / ((double) model.faceCount() * INSTANCE_COUNT));
+
+  data.directional.clear();
+}
+
+
+//
+// Times finding the silhouette through the cluster tree against the kernels
+// on every face and edge, for point lights circling the model (every fourth
+// one directional instead). Both have to give the same light facing faces
+// and the same edges, in a different order, or false is returned.
+//
+static bool benchClustered(const char *name, const ObjModel& model)
+{
+  const SilhouetteData& data = model.silhouetteData;
+
+  Vec3 min, max;
+  model.findBoundingBox(min, max);
+  float r = (max - min).mag() + 1.0f;
+
+  vector<Vec3> lights;
+  makeLightRing(r, 4, lights);
+
+  // Both are timed reusing their arrays, the way Caster does.
+  vector<uint> facing;
+  vector<int> edges;
+
+  double start = now();
+  for (int i = 0; i < LIGHT_COUNT; i++)
+  {
+    findLightFacing(data, lights[i], facing);
+    findSilhouetteEdges(data, facing, edges);
+  }
+  double fullTime = (now() - start) / LIGHT_COUNT;
+
+  start = now();
+  for (int i = 0; i < LIGHT_COUNT; i++)
+    findClusteredSilhouette(data, lights[i], facing, edges);
+  double clusterTime = (now() - start) / LIGHT_COUNT;
+
+  vector<uint> expectedFacing;
+  vector<int> expected;
+  bool same = true;
+  int silhouette = 0;
+
+  for (int i = 0; i < LIGHT_COUNT; i++)
+  {
+    findLightFacing(data, lights[i], expectedFacing);
+    findSilhouetteEdges(data, expectedFacing, expected);
+    findClusteredSilhouette(data, lights[i], facing, edges);
+
+    std::sort(edges.begin(), edges.end());
+    same = same && edges == expected && facing == expectedFacing;
+    silhouette += edges.size();
+  }
+
+  printf("%-24s %9d %10d %9d %10.1f %10.1f %8.1fx %5s\n", name,
+      model.faceCount(), (int) data.clusters.size(), silhouette / LIGHT_COUNT,
+      fullTime * 1e6, clusterTime * 1e6, fullTime / clusterTime,
+      same ? "yes" : "NO");
+
+  return same;
+}
+
+
+//
+// Follows a light moving a little every frame around a convex model,
+// finding the silhouette edges by testing every edge and by following the
+// last frame's silhouette around. Both have to give the same edges, in a
+// different order. The light facing faces are found beforehand for both.
+// Walks which had to test every edge after all are counted, which is every
+// one on models too small for the walk to be used. Returns false if the
+// edges ever differ.
+//
+static bool benchConvex(const char *name, const ObjModel& model)
+{
+  const SilhouetteData& data = model.silhouetteData;
+
+  Vec3 min, max;
+  model.findBoundingBox(min, max);
+  float size = (max - min).mag();
+  float r = size + 1.0f;
+
+  vector<vector<uint> > facing(FRAME_COUNT);
+  for (int i = 0; i < FRAME_COUNT; i++)
+  {
+    float a = FRAME_STEP * size / r * i;
+    Vec3 light(r * cos(a), 0.5f * r * sin(3.0f * a), r * sin(a), 1.0f);
+    findLightFacing(data, light, facing[i]);
+  }
+
+  vector<vector<int> > expected(FRAME_COUNT);
+
+  double start = now();
+  for (int i = 0; i < FRAME_COUNT; i++)
+    findSilhouetteEdges(data, facing[i], expected[i]);
+  double scanTime = (now() - start) / FRAME_COUNT;
+
+  // The first frame has no last silhouette to start from.
+  vector<vector<int> > walked(FRAME_COUNT);
+  int fallbacks = 0;
+
+  start = now();
+  for (int i = 0; i < FRAME_COUNT; i++)
+  {
+    if (i == 0 || !walkConvexSilhouette(data, facing[i], walked[i - 1],
+          walked[i]))
+    {
+      findSilhouetteEdges(data, facing[i], walked[i]);
+      fallbacks++;
+    }
+  }
+  double walkTime = (now() - start) / FRAME_COUNT;
+
+  bool same = true;
+  for (int i = 0; i < FRAME_COUNT; i++)
+  {
+    std::sort(walked[i].begin(), walked[i].end());
+    same = same && walked[i] == expected[i];
+  }
+
+  printf("%-24s %9d %6s %9d %10.1f %10.1f %8.1fx %9d %5s\n", name,
+      model.faceCount(), data.convex ? "yes" : "no",
+      (int) expected[0].size(), scanTime * 1e6, walkTime * 1e6,
+      scanTime / walkTime, fallbacks, same ? "yes" : "NO");
+
+  return same;
+}
+
+
+//
+// Makes the shadow proxies of a model and times finding silhouettes on each
+// of them against the model itself, for the same lights as
+// benchClustered(). Each proxy has to be closed, or false is returned.
+//
+static bool benchProxies(const char *name, ObjModel& model)
+{
+  double start = now();
+  model.buildShadowProxies();
+  double buildTime = now() - start;
+
+  Vec3 min, max;
+  model.findBoundingBox(min, max);
+  float r = (max - min).mag() + 1.0f;
+
+  vector<Vec3> lights;
+  makeLightRing(r, 4, lights);
+
+  vector<uint> facing;
+  vector<int> edges;
+  double fullTime = 0.0;
+  bool allClosed = true;
+
+  for (int level = 0; level <= model.shadowProxies.size(); level++)
+  {
+    const Model& shadow = (level == 0) ? model :
+      *model.shadowProxies[level - 1].model;
+    float error = (level == 0) ? 0.0f : model.shadowProxies[level - 1].error;
+
+    int silhouette = 0;
+    double start = now();
+    for (int i = 0; i < LIGHT_COUNT; i++)
+    {
+      findClusteredSilhouette(shadow.silhouetteData, lights[i], facing,
+          edges);
+      silhouette += edges.size();
+    }
+    double time = (now() - start) / LIGHT_COUNT;
+
+    if (level == 0)
+      fullTime = time;
+
+    char label[32];
+    if (level == 0)
+      sprintf(label, "%s", name);
+    else
+      sprintf(label, "  proxy %d", level);
+
+    bool closed = shadow.boundaryEdges == 0 && shadow.nonManifoldEdges == 0;
+    allClosed = allClosed && closed;
+
+    printf("%-24s %9d %9.4f %6s %9d %10.1f %8.1fx", label,
+        shadow.faceCount(), error, closed ? "yes" : "NO",
+        silhouette / LIGHT_COUNT, time * 1e6, fullTime / time);
+
+    if (level == 0)
+      printf(" %9.3f", buildTime);
+    printf("\n");
+  }
+
+  return allClosed;
+}
+
+
+//
+// Loads an OBJ file without its shadow proxies or the cache.
+//
+static void loadModel(ObjModel& model, const char *filename,
+    const ObjParser& parser)
+{
+  model.setBuildProxies(false);
+  model.loadFile(filename, parser, false);
+}
+
+
+int main(int argc, char **argv)
+{
+  int maxTriangles = (argc > 1) ? atoi(argv[1]) : 5000000;
+  const int sizes[] = { 100000, 250000, 500000, 1000000, 2500000, 5000000 };
+  bool ok = true;
+
+  printf("%10s %10s %10s %10s %10s %10s %10s %6s\n", "triangles", "edges",
+      "boundary", "non-man.", "edges (s)", "bison MB/s", "mapped MB/s",
+      "same");
+
+  for (int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+  {
+    if (sizes[i] > maxTriangles)
+      break;
+
+    // Time the edge matching on its own first.
+    Model mesh;
+    makeTorus(mesh, sizes[i]);
+
+    double start = now();
+    mesh.buildEdges();
+    double edgeTime = now() - start;
+
+    // Then the full load from a file with each parser.
+    writeObj(mesh, BENCH_FILE);
+
+    struct stat st;
+    stat(BENCH_FILE, &st);
+    double mb = st.st_size / 1048576.0;
+
+    ObjModel bison, mapped;
+
+    start = now();
+    loadModel(bison, BENCH_FILE, OBJ_BISON);
+    double bisonTime = now() - start;
+
+    start = now();
+    loadModel(mapped, BENCH_FILE, OBJ_MAPPED);
+    double mappedTime = now() - start;
+
+    bool same = sameModel(bison, mapped);
+    ok = ok && same;
+
+    printf("%10d %10d %10d %10d %10.3f %10.1f %10.1f %6s\n",
+        mapped.faceCount(), (int) mapped.edgeArray.size(),
+        mapped.boundaryEdges, mapped.nonManifoldEdges, edgeTime,
+        mb / bisonTime, mb / mappedTime, same ? "yes" : "NO");
+  }
+
+  // Then everything else the two parsers have to agree on.
+  {
+    writeSyntaxObj(BENCH_FILE);
+
+    ObjModel bison, mapped;
+    loadModel(bison, BENCH_FILE, OBJ_BISON);
+    loadModel(mapped, BENCH_FILE, OBJ_MAPPED);
+
+    bool same = sameModel(bison, mapped) && bison.faceCount() > 0;
+    ok = ok && same;
+
+    printf("\n%-24s %9s %6s\n", "parity", "faces", "same");
+    printf("%-24s %9d %6s\n", "mixed syntax", mapped.faceCount(),
+        same ? "yes" : "NO");
+  }
+
+  // Silhouettes of the given models and a 1M face torus. Everything is
+  // loaded before the table is started.
+  vector<const char *> names;
+  for (int i = 2; i < argc; i++)
+    names.push_back(argv[i]);
+  if (names.size() == 0)
+    names.assign(DEFAULT_MODELS, DEFAULT_MODELS + 2);
+
+  vector<ObjModel *> models;
+  for (int i = 0; i < names.size(); i++)
+  {
+    models.push_back(new ObjModel());
+    loadModel(*models.back(), names[i], OBJ_MAPPED);
+  }
+
+  Model mesh;
+  makeTorus(mesh, 1000000);
+  writeObj(mesh, BENCH_FILE);
+
+  names.push_back("1M face torus");
+  models.push_back(new ObjModel());
+  loadModel(*models.back(), BENCH_FILE, OBJ_MAPPED);
+
+  printf("\n%-24s %9s %10s %10s   %10s   %10s   %8s\n", "silhouette", "faces",
+      "old (us)", "plain (us)", "sse (us)", "avx2 (us)", "speedup");
+
+  for (int i = 0; i < models.size(); i++)
+  {
+    if (models[i]->faceCount() > 0)
+      ok = benchSilhouette(names[i], *models[i]) && ok;
+  }
+
+  printf("\n%-24s %9s %10s %10s %10s %10s %8s %8s %5s\n", "incremental",
+      "faces", "near", "full (us)", "median(us)", "mean (us)", "searches",
+      "flipped", "same");
+
+  for (int i = 0; i < models.size(); i++)
+  {
+    if (models[i]->faceCount() > 0)
+      ok = benchIncremental(names[i], *models[i]) && ok;
+  }
+
+  printf("\n%-24s %9s %10s %10s %10s %9s %8s\n", "directional", "faces",
+      "instances", "full (us)", "lookup(us)", "speedup", "differ");
+
+  for (int i = 0; i < models.size(); i++)
+  {
+    if (models[i]->faceCount() > 0)
+      benchDirectional(names[i], *models[i]);
+    delete models[i];
+  }
+
+  printf("\n%-24s %9s %10s %9s %10s %10s %9s %5s\n", "clustered", "faces",
+      "clusters", "sil.edges", "full (us)", "tree (us)", "speedup", "same");
+
+  for (int i = 0; i < sizeof(CLUSTER_SIZES) / sizeof(CLUSTER_SIZES[0]); i++)
+  {
+    Model torus;
+    makeTorus(torus, CLUSTER_SIZES[i]);
+    writeObj(torus, BENCH_FILE);
+
+    char name[32];
+    sprintf(name, "%dK face torus", CLUSTER_SIZES[i] / 1000);
+
+    ObjModel loaded;
+    loadModel(loaded, BENCH_FILE, OBJ_MAPPED);
+    ok = benchClustered(name, loaded) && ok;
+  }
+
+  printf("\n%-24s %9s %6s %9s %10s %10s %9s %9s %5s\n", "convex", "faces",
+      "convex", "sil.edges", "scan (us)", "walk (us)", "speedup", "fallbacks",
+      "same");
+
+  for (int i = 0; i < sizeof(CONVEX_SIZES) / sizeof(CONVEX_SIZES[0]); i++)
+  {
+    Model sphere;
+    makeSphere(sphere, CONVEX_SIZES[i]);
+    writeObj(sphere, BENCH_FILE);
+
+    char name[32];
+    sprintf(name, "%dK face sphere", CONVEX_SIZES[i] / 1000);
+
+    ObjModel loaded;
+    loadModel(loaded, BENCH_FILE, OBJ_MAPPED);
+    ok = benchConvex(name, loaded) && ok;
+  }
+
+  printf("\n%-24s %9s %9s %6s %9s %10s %9s %9s\n", "proxies", "faces",
+      "error", "closed", "sil.edges", "search(us)", "speedup", "build (s)");
+
+  for (int i = 0; i < sizeof(PROXY_SIZES) / sizeof(PROXY_SIZES[0]); i++)
+  {
+    Model torus;
+    makeTorus(torus, PROXY_SIZES[i]);
+    writeObj(torus, BENCH_FILE);
+
+    char name[32];
+    sprintf(name, "%dK face torus", PROXY_SIZES[i] / 1000);
+
+    ObjModel loaded;
+    loadModel(loaded, BENCH_FILE, OBJ_MAPPED);
+    ok = benchProxies(name, loaded) && ok;
+  }
+
+  remove(BENCH_FILE);
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,667 @@
+//
+// objscan.cpp
+//
+// A hand written OBJ scanner which works in place on a memory mapped file.
+// It fills in the same ObjLoadData and face arrays as the bison grammar in
+// grammar.y, but without a token per number or a grammar action per vertex.
+// Short numbers are parsed directly, without the C locale getting involved.
+//
+// Large files are split into chunks at line boundaries which are scanned in
+// parallel on the shared ThreadPool, then merged back together in file order.
+// The result is the same no matter how many chunks were used.
+//
+
+#include "obj.h"
+#include "../thread/threadpool.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <algorithm>
+
+
+// Files are only split into chunks of at least this many bytes.
+static const size_t MIN_CHUNK_SIZE = 512 * 1024;
+
+
+// Powers of ten which are exact as floats. A float mantissa of at most 24
+// bits combined with one of these is correctly rounded in a single step.
+static const float FLOAT_POW10[] =
+{
+  1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+
+static const int FLOAT_POW10_MAX = 10;
+
+// Longest integer which always fits in an int.
+static const int INT_DIGITS_MAX = 9;
+
+// Numbers up to this long are copied to the stack for strtof.
+static const size_t FLOAT_TOKEN_MAX = 63;
+
+
+//
+// Blanks separate tokens on a line, newlines separate statements.
+//
+static inline bool isBlank (const char& c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+
+static inline bool isDigit (const char& c)
+{
+  return c >= '0' && c <= '9';
+}
+
+
+static inline void skipBlanks (const char *&p, const char *end)
+{
+  while (p != end && isBlank(*p))
+    ++p;
+}
+
+
+//
+// Reads a signed integer at p, leaving p after the last digit. Returns false
+// if there is no number there, or it is too long to fit in an int, which the
+// lexer reads as a float instead.
+//
+static bool scanInt (const char *&p, const char *end, int& value)
+{
+  const char *q = p;
+  bool negative = false;
+
+  if (q != end && (*q == '+' || *q == '-'))
+    negative = (*q++ == '-');
+
+  if (q == end || !isDigit(*q))
+    return false;
+
+  int n = 0;
+  const char *digits = q;
+  while (q != end && isDigit(*q))
+    n = n * 10 + (*q++ - '0');
+
+  if (q - digits > INT_DIGITS_MAX)
+    return false;
+
+  value = negative ? -n : n;
+  p = q;
+  return true;
+}
+
+
+//
+// Reads a signed decimal (with optional fraction and exponent) at p, leaving
+// p after the number. Returns false if there is no number there. The common
+// short values found in OBJ files take the exact single precision path, the
+// rest go through strtof so that every value matches the lexer bit for bit.
+//
+static bool scanFloat (const char *&p, const char *end, float& value)
+{
+  const char *q = p;
+  bool negative = false;
+
+  if (q != end && (*q == '+' || *q == '-'))
+    negative = (*q++ == '-');
+
+  unsigned long long mantissa = 0;
+  int digits   = 0;
+  int exponent = 0;
+  bool any     = false;
+
+  // Only the first 19 significant digits fit, the rest just scale.
+  for (; q != end && isDigit(*q); ++q, any = true)
+  {
+    if (digits < 19)
+    {
+      mantissa = mantissa * 10 + (*q - '0');
+      if (mantissa) digits++;
+    }
+    else
+      exponent++;
+  }
+
+  if (q != end && *q == '.')
+  {
+    for (++q; q != end && isDigit(*q); ++q, any = true)
+    {
+      if (digits < 19)
+      {
+        mantissa = mantissa * 10 + (*q - '0');
+        if (mantissa) digits++;
+        exponent--;
+      }
+    }
+  }
+
+  if (!any)
+    return false;
+
+  if (q != end && (*q == 'e' || *q == 'E'))
+  {
+    const char *e = q + 1;
+    bool negExp = false;
+
+    if (e != end && (*e == '+' || *e == '-'))
+      negExp = (*e++ == '-');
+
+    if (e != end && isDigit(*e))
+    {
+      int n = 0;
+      for (; e != end && isDigit(*e); ++e)
+        if (n < 10000) n = n * 10 + (*e - '0');
+
+      exponent += negExp ? -n : n;
+      q = e;
+    }
+  }
+
+  if (mantissa <= (1 << 24) && exponent >= -FLOAT_POW10_MAX &&
+      exponent <= FLOAT_POW10_MAX)
+  {
+    if (exponent < 0)
+      value = (float) mantissa / FLOAT_POW10[-exponent];
+    else
+      value = (float) mantissa * FLOAT_POW10[exponent];
+  }
+  else
+  {
+    // Anything else is rounded once by strtof, like the lexer, rather than
+    // going through a double and rounding twice.
+    char buf[FLOAT_TOKEN_MAX + 1];
+    size_t length = q - p;
+
+    if (length <= FLOAT_TOKEN_MAX)
+    {
+      std::copy(p, q, buf);
+      buf[length] = '\0';
+      value = strtof(buf, NULL);
+    }
+    else
+      value = strtof(string(p, q).c_str(), NULL);
+
+    p = q;
+    return true;
+  }
+
+  if (negative)
+    value = -value;
+
+  p = q;
+  return true;
+}
+
+
+//
+// Reads up to max floats from the rest of the line, returns the count.
+//
+static int scanFloats (const char *&p, const char *end, float *values,
+    const int& max)
+{
+  int count = 0;
+
+  for (;;)
+  {
+    skipBlanks(p, end);
+    if (count == max || !scanFloat(p, end, values[count]))
+      break;
+    count++;
+  }
+
+  return count;
+}
+
+
+//
+// Reads a v, v/t, v//n or v/t/n face vertex. Missing indexes are left as 0,
+// the same as the grammar.
+//
+static bool scanTriplet (const char *&p, const char *end, int *triplet)
+{
+  triplet[0] = triplet[1] = triplet[2] = 0;
+
+  if (!scanInt(p, end, triplet[0]))
+    return false;
+
+  if (p != end && *p == '/')
+  {
+    ++p;
+    scanInt(p, end, triplet[1]);
+
+    if (p != end && *p == '/')
+    {
+      ++p;
+      if (!scanInt(p, end, triplet[2]))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+
+//
+// A face vertex as it was written in the file. Relative (negative) indexes
+// can't be resolved until the chunks before this one have been counted, so
+// they are stored relative to the start of the chunk and flagged.
+//
+struct ObjCorner
+{
+  int index[3];                 // Vertex, texture and normal indexes.
+  int relative;                 // Bit i set if index[i] is chunk relative.
+};
+
+
+//
+// Everything scanned out of one chunk of the file, and where it ends up
+// once all the chunks are merged.
+//
+struct ObjChunk
+{
+  const char *begin;
+  const char *end;
+
+  Vec3Array vertices;
+  Vec3Array texCoords;
+  Vec3Array normals;
+  vector<ObjCorner> corners;    // Three per triangle.
+  vector<string> materials;     // usemtl names in file order.
+
+  int lines;
+  int errorLine;                // Relative to the chunk, 0 if no error.
+  int used[3];                  // Corners with a vertex, texCoord, normal.
+
+  int base[3];                  // First vertex, texCoord, normal in ld.
+  int faceStart;                // First face in faceArray.
+  int start[3];                 // First entry in vertArray, textArray...
+  int badIndexes;
+
+  ObjChunk (void)
+    : begin(NULL), end(NULL), lines(0), errorLine(0), faceStart(0),
+      badIndexes(0)
+  {
+    for (int i = 0; i < 3; i++)
+      used[i] = base[i] = start[i] = 0;
+  }
+};
+
+
+//
+// Reads a v, v/t, v//n or v/t/n face vertex. Missing indexes are left as 0,
+// the same as the grammar. Relative indexes are converted to be relative to
+// the start of the chunk.
+//
+static bool scanCorner (const char *&p, const char *end, ObjChunk& chunk,
+    ObjCorner& corner)
+{
+  int triplet[3];
+  if (!scanTriplet(p, end, triplet))
+    return false;
+
+  const int counts[3] = { (int) chunk.vertices.size(),
+    (int) chunk.texCoords.size(), (int) chunk.normals.size() };
+
+  corner.relative = 0;
+
+  for (int i = 0; i < 3; i++)
+  {
+    if (triplet[i] < 0)
+    {
+      corner.index[i] = counts[i] + triplet[i];
+      corner.relative |= (1 << i);
+    }
+    else
+      corner.index[i] = triplet[i];
+  }
+
+  return true;
+}
+
+
+//
+// Adds a triangle to the chunk, counting the attributes it will use.
+//
+static void addTriangle (ObjChunk& chunk, const ObjCorner *tri)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    chunk.corners.push_back(tri[i]);
+
+    for (int j = 0; j < 3; j++)
+      if ((tri[i].relative & (1 << j)) || tri[i].index[j] != 0)
+        chunk.used[j]++;
+  }
+}
+
+
+//
+// Scans one chunk of the file. Stops at the first syntax error and records
+// the line it was on.
+//
+// Statements the engine has no use for (groups, smoothing, mtllib...) are
+// skipped rather than treated as errors. Faces with more than three vertices
+// are split into a fan of triangles. The lexer and grammar accept the same
+// language, see lexer.l.
+//
+static void scanChunk (ObjChunk& chunk)
+{
+  const char *p   = chunk.begin;
+  const char *end = chunk.end;
+
+  while (p != end)
+  {
+    skipBlanks(p, end);
+
+    const char *word = p;
+    while (p != end && !isBlank(*p) && *p != '\n')
+      ++p;
+
+    int length = p - word;
+    bool ok = true;
+    bool statement = true;
+
+    if (length == 1 && word[0] == 'v')
+    {
+      float v[4];
+      int count = scanFloats(p, end, v, 4);
+
+      // As in the grammar, homogeneous vertices are accepted but dropped.
+      if (count == 3)
+        chunk.vertices.push_back(Vec3(v[0], v[1], v[2]));
+      else
+        ok = (count == 4);
+    }
+    else if (length == 2 && word[0] == 'v' && word[1] == 't')
+    {
+      float t[3] = { 0.0f, 0.0f, 0.0f };
+      int count = scanFloats(p, end, t, 3);
+
+      if (count == 1)
+        chunk.texCoords.push_back(Vec3(t[0], 0.0f, 0.0f));
+      else if (count > 1)
+        chunk.texCoords.push_back(Vec3(t[0], 1.0f - t[1], t[2]));
+      else
+        ok = false;
+    }
+    else if (length == 2 && word[0] == 'v' && word[1] == 'n')
+    {
+      float n[3];
+      if ((ok = (scanFloats(p, end, n, 3) == 3)))
+        chunk.normals.push_back(Vec3(n[0], n[1], n[2]));
+    }
+    else if (length == 1 && word[0] == 'f')
+    {
+      ObjCorner tri[3], corner;
+      int count = 0;
+
+      for (;; count++)
+      {
+        skipBlanks(p, end);
+        if (!scanCorner(p, end, chunk, corner))
+          break;
+
+        if (count < 3)
+          tri[count] = corner;
+        else
+        {
+          tri[1] = tri[2];
+          tri[2] = corner;
+        }
+
+        if (count >= 2)
+          addTriangle(chunk, tri);
+      }
+
+      ok = (count >= 3);
+    }
+    else if (length == 6 && string(word, length) == "usemtl")
+    {
+      skipBlanks(p, end);
+
+      const char *name = p;
+      while (p != end && !isBlank(*p) && *p != '\n')
+        ++p;
+
+      chunk.materials.push_back(string(name, p - name));
+    }
+    else
+    {
+      // Comments and statements the engine doesn't use.
+      statement = false;
+    }
+
+    // A statement has to take up the rest of its line, bar a comment.
+    skipBlanks(p, end);
+    if (statement && p != end && *p != '\n' && *p != '#')
+      ok = false;
+
+    if (!ok)
+    {
+      chunk.errorLine = chunk.lines + 1;
+      return;
+    }
+
+    while (p != end && *p != '\n')
+      ++p;
+
+    if (p != end)
+    {
+      ++p;
+      chunk.lines++;
+    }
+  }
+}
+
+
+//
+// Writes the faces of a chunk and the vertices, texCoords and normals they
+// use into the model, in the slots set aside for it by the merge. This does
+// exactly what ObjModel::addFaceVertex does for each face vertex.
+//
+static void fillChunk (Model& model, const ObjLoadData& ld, ObjChunk& chunk)
+{
+  const Vec3Array *src[3] = { &ld.vertices, &ld.texCoords, &ld.normals };
+  Vec3Array *dst[3] = { &model.vertArray, &model.textArray, &model.normArray };
+
+  int out[3] = { chunk.start[0], chunk.start[1], chunk.start[2] };
+  int faces = chunk.corners.size() / 3;
+
+  for (int f = 0; f < faces; f++)
+  {
+    Face& face = model.faceArray[chunk.faceStart + f];
+    face.vStart = out[0];
+
+    for (int k = 0; k < 3; k++)
+    {
+      const ObjCorner& corner = chunk.corners[f * 3 + k];
+
+      face.index[k] = -1;
+
+      for (int j = 0; j < 3; j++)
+      {
+        bool relative = corner.relative & (1 << j);
+        if (!relative && corner.index[j] == 0)
+          continue;
+
+        int i = relative ? chunk.base[j] + corner.index[j]
+                         : corner.index[j] - 1;
+
+        if (i >= 0 && i < src[j]->size())
+        {
+          (*dst[j])[out[j]] = (*src[j])[i];
+          if (j == 0)
+            face.index[k] = i;
+        }
+        else
+          chunk.badIndexes++;
+
+        out[j]++;
+      }
+    }
+  }
+}
+
+
+//
+// Jobs for running the two passes on the ThreadPool.
+//
+class ScanJob : public Job
+{
+
+public:
+
+  ObjChunk *chunk;
+
+  void run (void)
+  { scanChunk(*chunk); }
+
+};
+
+
+class FillJob : public Job
+{
+
+public:
+
+  Model *model;
+  const ObjLoadData *ld;
+  ObjChunk *chunk;
+
+  void run (void)
+  { fillChunk(*model, *ld, *chunk); }
+
+};
+
+
+//
+// Scans a whole OBJ file held in memory. Returns 0 on success and 1 on a
+// syntax error, matching yyparse(). Like the grammar, everything up to the
+// first error is kept.
+//
+int ObjModel::scanFile (const char *data, const size_t& size,
+    ObjLoadData& ld)
+{
+  ThreadPool& pool = ThreadPool::getShared();
+
+  // Split the file into a chunk per thread, as long as they aren't tiny.
+  int chunkCount = std::min<size_t>(pool.getThreadCount() + 1,
+      size / MIN_CHUNK_SIZE);
+  if (chunkCount < 1)
+    chunkCount = 1;
+
+  vector<ObjChunk> chunks(chunkCount);
+  const char *p   = data;
+  const char *end = data + size;
+
+  for (int i = 0; i < chunkCount; i++)
+  {
+    const char *split = end;
+
+    if (i < chunkCount - 1)
+    {
+      split = std::max(p, data + size / chunkCount * (i + 1));
+      while (split != end && *split != '\n')
+        ++split;
+      if (split != end)
+        ++split;
+    }
+
+    chunks[i].begin = p;
+    chunks[i].end   = split;
+    p = split;
+  }
+
+  JobGroup scanning;
+  vector<ScanJob> scanJobs(chunkCount);
+
+  for (int i = 0; i < chunkCount; i++)
+  {
+    scanJobs[i].chunk = &chunks[i];
+    pool.submit(&scanJobs[i], scanning);
+  }
+
+  pool.wait(scanning);
+
+  // Work out where every chunk goes, in file order. Only the chunks up to
+  // the first error are used.
+  int result = 0;
+  int usedChunks = chunkCount;
+  int lines = 0;
+
+  for (int i = 0; i < chunkCount; i++)
+  {
+    if (chunks[i].errorLine)
+    {
+      fprintf(stderr, "%d: syntax error\n", lines + chunks[i].errorLine);
+      result = 1;
+      usedChunks = i + 1;
+      break;
+    }
+
+    lines += chunks[i].lines;
+  }
+
+  int faces = faceArray.size();
+  int out[3] = { (int) vertArray.size(), (int) textArray.size(),
+    (int) normArray.size() };
+
+  for (int i = 0; i < usedChunks; i++)
+  {
+    ObjChunk& chunk = chunks[i];
+
+    chunk.base[0] = ld.vertices.size();
+    chunk.base[1] = ld.texCoords.size();
+    chunk.base[2] = ld.normals.size();
+
+    ld.vertices.insert(ld.vertices.end(), chunk.vertices.begin(),
+        chunk.vertices.end());
+    ld.texCoords.insert(ld.texCoords.end(), chunk.texCoords.begin(),
+        chunk.texCoords.end());
+    ld.normals.insert(ld.normals.end(), chunk.normals.begin(),
+        chunk.normals.end());
+
+    chunk.faceStart = faces;
+    faces += chunk.corners.size() / 3;
+
+    for (int j = 0; j < 3; j++)
+    {
+      chunk.start[j] = out[j];
+      out[j] += chunk.used[j];
+    }
+
+    for (int j = 0; j < chunk.materials.size(); j++)
+      useTexture(chunk.materials[j].c_str());
+  }
+
+  faceArray.resize(faces);
+  vertArray.resize(out[0]);
+  textArray.resize(out[1]);
+  normArray.resize(out[2]);
+
+  JobGroup filling;
+  vector<FillJob> fillJobs(usedChunks);
+
+  for (int i = 0; i < usedChunks; i++)
+  {
+    fillJobs[i].model = this;
+    fillJobs[i].ld    = &ld;
+    fillJobs[i].chunk = &chunks[i];
+    pool.submit(&fillJobs[i], filling);
+  }
+
+  pool.wait(filling);
+
+  int badIndexes = 0;
+  for (int i = 0; i < usedChunks; i++)
+    badIndexes += chunks[i].badIndexes;
+
+  if (badIndexes > 0)
+  {
+    fprintf(stderr, "%d face indexes out of range\n", badIndexes);
+    result = 1;
+  }
+
+  return result;
+}
@@ -0,0 +1,398 @@
+//
+// smesh.cpp
+//
+// Reading and writing of precooked .smesh mesh caches. A cache holds
+// everything an ObjModel has once it has been parsed and post processed, so
+// loading one skips both steps. The whole file is mapped in one go and the
+// arrays are copied straight out of it.
+//
+// The model's shadow proxies are kept too, each with its own vertices,
+// faces and edges.
+//
+// Layout (native byte order):
+//
+//   SMeshHeader
+//   SMeshProxy proxies[proxyCount]
+//   Vec3      realVerts[realVertCount]
+//   Vec3      vertArray[vertCount]
+//   Vec3      normArray[normCount]
+//   Vec3      textArray[textCount]
+//   uint      elemArray[elemCount]
+//   SMeshFace faceArray[faceCount]
+//   SMeshEdge edgeArray[edgeCount]
+//   for each proxy:
+//     Vec3      realVerts[vertCount]
+//     SMeshFace faceArray[faceCount]
+//     SMeshEdge edgeArray[edgeCount]
+//   char      texture[textureLength]
+//
+
+#include "obj.h"
+#include "mapfile.h"
+#include "../ltypes.h"
+
+#include <cstdio>
+#include <cstring>
+
+
+static const char SMESH_MAGIC[4]   = { 'S', 'M', 'S', 'H' };
+static const uint SMESH_BYTE_ORDER = 0x01020304;
+
+// Bump this whenever the layout or the post processing changes.
+static const uint SMESH_VERSION    = 5;
+
+static const uint SMESH_HAS_NORMALS   = 1 << 0;
+static const uint SMESH_HAS_TEXCOORDS = 1 << 1;
+static const uint SMESH_HAS_PROXIES   = 1 << 2;
+
+
+struct SMeshHeader
+{
+  char magic[4];
+  uint byteOrder;
+  uint version;
+  uint flags;
+
+  long long sourceSize;         // Size and modification time of the OBJ
+  long long sourceTime;         // the cache was made from.
+
+  uint realVertCount;
+  uint vertCount;
+  uint normCount;
+  uint textCount;
+  uint faceCount;
+  uint edgeCount;
+  uint textureLength;
+
+  uint elemCount;
+
+  int boundaryEdges;
+  int nonManifoldEdges;
+
+  uint proxyCount;
+
+  float weldTolerance;          // See ObjModel::setWeldTolerance().
+};
+
+
+struct SMeshProxy
+{
+  uint vertCount;
+  uint faceCount;
+  uint edgeCount;
+  float error;
+};
+
+
+struct SMeshFace
+{
+  int index[3];
+  int vStart;
+  Vec3 normal;
+};
+
+
+struct SMeshEdge
+{
+  int v1, v2;
+  int f1, f2;
+};
+
+
+//
+// Size of the file a header and its table of proxies describe.
+//
+static size_t getCacheSize (const SMeshHeader& h, const SMeshProxy *proxies)
+{
+  size_t size = sizeof(SMeshHeader) +
+    sizeof(SMeshProxy) * (size_t) h.proxyCount +
+    sizeof(Vec3) * ((size_t) h.realVertCount + h.vertCount + h.normCount +
+        h.textCount) +
+    sizeof(uint) * (size_t) h.elemCount +
+    sizeof(SMeshFace) * (size_t) h.faceCount +
+    sizeof(SMeshEdge) * (size_t) h.edgeCount +
+    h.textureLength;
+
+  for (uint i = 0; i < h.proxyCount; i++)
+  {
+    size += sizeof(Vec3) * (size_t) proxies[i].vertCount +
+      sizeof(SMeshFace) * (size_t) proxies[i].faceCount +
+      sizeof(SMeshEdge) * (size_t) proxies[i].edgeCount;
+  }
+
+  return size;
+}
+
+
+//
+// Copies count Vec3s out of the mapped file into an array.
+//
+static const char *readVectors (const char *p, const uint& count,
+    vector<Vec3>& array)
+{
+  const Vec3 *v = reinterpret_cast<const Vec3 *>(p);
+  array.assign(v, v + count);
+  return p + sizeof(Vec3) * count;
+}
+
+
+//
+// Copies count faces out of the mapped file into an array.
+//
+static const char *readFaces (const char *p, const uint& count,
+    vector<Face>& faceArray)
+{
+  const SMeshFace *faces = reinterpret_cast<const SMeshFace *>(p);
+  faceArray.resize(count);
+
+  for (int i = 0; i < count; i++)
+  {
+    Face& face = faceArray[i];
+    face.index[0] = faces[i].index[0];
+    face.index[1] = faces[i].index[1];
+    face.index[2] = faces[i].index[2];
+    face.vStart   = faces[i].vStart;
+    face.normal   = faces[i].normal;
+  }
+
+  return p + sizeof(SMeshFace) * count;
+}
+
+
+//
+// Copies count edges of a model out of the mapped file into an array.
+//
+static const char *readEdges (const char *p, const uint& count,
+    EdgeArray& edgeArray, Model *model)
+{
+  const SMeshEdge *edges = reinterpret_cast<const SMeshEdge *>(p);
+  edgeArray.clear();
+  edgeArray.reserve(count);
+
+  for (int i = 0; i < count; i++)
+  {
+    edgeArray.push_back(Edge(edges[i].v1, edges[i].v2, edges[i].f1,
+          edges[i].f2, model));
+  }
+
+  return p + sizeof(SMeshEdge) * count;
+}
+
+
+//
+// Writes the faces of a model out. Returns false if the write failed.
+//
+static bool writeFaces (FILE *out, const vector<Face>& faceArray)
+{
+  vector<SMeshFace> faces(faceArray.size());
+  for (int i = 0; i < faceArray.size(); i++)
+  {
+    memcpy(faces[i].index, faceArray[i].index, sizeof(faces[i].index));
+    faces[i].vStart = faceArray[i].vStart;
+    faces[i].normal = faceArray[i].normal;
+  }
+
+  return faces.size() == 0 ||
+    fwrite(&faces[0], sizeof(SMeshFace), faces.size(), out) == faces.size();
+}
+
+
+//
+// Writes the edges of a model out. Returns false if the write failed.
+//
+static bool writeEdges (FILE *out, const EdgeArray& edgeArray)
+{
+  vector<SMeshEdge> edges(edgeArray.size());
+  for (int i = 0; i < edgeArray.size(); i++)
+  {
+    const Edge& e = edgeArray[i];
+    SMeshEdge edge = { e.v1, e.v2, e.f1, e.f2 };
+    edges[i] = edge;
+  }
+
+  return edges.size() == 0 ||
+    fwrite(&edges[0], sizeof(SMeshEdge), edges.size(), out) == edges.size();
+}
+
+
+//
+// Replaces the model with the contents of a cache. Returns false, leaving
+// the model untouched, if the cache is missing, from a different version or
+// machine, or older than the OBJ it was made from, or made without shadow
+// proxies when they are wanted. A negative sourceSize skips the age check.
+//
+bool ObjModel::loadCache (const string& path, const long long& sourceSize,
+    const long long& sourceTime)
+{
+  MappedFile file(path);
+
+  if (!file.isOpen() || file.getSize() < sizeof(SMeshHeader))
+    return false;
+
+  SMeshHeader header;
+  memcpy(&header, file.getData(), sizeof(SMeshHeader));
+
+  if (memcmp(header.magic, SMESH_MAGIC, 4) != 0 ||
+      header.byteOrder != SMESH_BYTE_ORDER ||
+      header.version != SMESH_VERSION ||
+      file.getSize() < sizeof(SMeshHeader) +
+        sizeof(SMeshProxy) * (size_t) header.proxyCount)
+    return false;
+
+  const SMeshProxy *proxies = reinterpret_cast<const SMeshProxy *>(
+      file.getData() + sizeof(SMeshHeader));
+
+  if (getCacheSize(header, proxies) != file.getSize())
+    return false;
+
+  if (sourceSize >= 0 && (header.sourceSize != sourceSize ||
+        header.sourceTime != sourceTime))
+    return false;
+
+  if (buildProxies && !(header.flags & SMESH_HAS_PROXIES))
+    return false;
+
+  if (header.weldTolerance != weldTolerance)
+    return false;
+
+  const char *p = file.getData() + sizeof(SMeshHeader) +
+    sizeof(SMeshProxy) * header.proxyCount;
+
+  p = readVectors(p, header.realVertCount, realVerts);
+  p = readVectors(p, header.vertCount, vertArray);
+  p = readVectors(p, header.normCount, normArray);
+  p = readVectors(p, header.textCount, textArray);
+
+  const uint *elems = reinterpret_cast<const uint *>(p);
+  elemArray.assign(elems, elems + header.elemCount);
+  p += sizeof(uint) * header.elemCount;
+
+  p = readFaces(p, header.faceCount, faceArray);
+  p = readEdges(p, header.edgeCount, edgeArray, this);
+
+  // The shadow proxies follow, see Model::buildShadowProxies().
+  clearShadowProxies();
+
+  for (int i = 0; i < header.proxyCount; i++)
+  {
+    Model *proxy = new Model();
+    p = readVectors(p, proxies[i].vertCount, proxy->realVerts);
+    p = readFaces(p, proxies[i].faceCount, proxy->faceArray);
+    p = readEdges(p, proxies[i].edgeCount, proxy->edgeArray, proxy);
+
+    ShadowProxy shadowProxy = { proxy, proxies[i].error };
+    shadowProxies.push_back(shadowProxy);
+  }
+
+  hasNormals       = (header.flags & SMESH_HAS_NORMALS) != 0;
+  hasTexCoords     = (header.flags & SMESH_HAS_TEXCOORDS) != 0;
+  boundaryEdges    = header.boundaryEdges;
+  nonManifoldEdges = header.nonManifoldEdges;
+
+  string texture(p, header.textureLength);
+  if (texture.size() > 0)
+    useTexture(texture.c_str());
+
+  silhouetteData.build(*this);
+
+  for (int i = 0; i < shadowProxies.size(); i++)
+    shadowProxies[i].model->silhouetteData.build(*shadowProxies[i].model);
+
+  return true;
+}
+
+
+//
+// Writes the model out as a cache. The file is written under a temporary
+// name and moved into place, so a half written cache is never read.
+//
+bool ObjModel::saveCache (const string& path, const long long& sourceSize,
+    const long long& sourceTime) const
+{
+  SMeshHeader header;
+  memset(&header, 0, sizeof(SMeshHeader));
+  memcpy(header.magic, SMESH_MAGIC, 4);
+
+  header.byteOrder        = SMESH_BYTE_ORDER;
+  header.version          = SMESH_VERSION;
+  header.flags            = (hasNormals ? SMESH_HAS_NORMALS : 0) |
+                            (hasTexCoords ? SMESH_HAS_TEXCOORDS : 0) |
+                            (buildProxies ? SMESH_HAS_PROXIES : 0);
+  header.sourceSize       = sourceSize;
+  header.sourceTime       = sourceTime;
+  header.realVertCount    = realVerts.size();
+  header.vertCount        = vertArray.size();
+  header.normCount        = normArray.size();
+  header.textCount        = textArray.size();
+  header.elemCount        = elemArray.size();
+  header.faceCount        = faceArray.size();
+  header.edgeCount        = edgeArray.size();
+  header.textureLength    = textureName.size();
+  header.boundaryEdges    = boundaryEdges;
+  header.nonManifoldEdges = nonManifoldEdges;
+  header.proxyCount       = shadowProxies.size();
+  header.weldTolerance    = weldTolerance;
+
+  string temp = path + ".tmp";
+  FILE *out = fopen(temp.c_str(), "wb");
+  if (!out)
+    return false;
+
+  bool ok = fwrite(&header, sizeof(SMeshHeader), 1, out) == 1;
+
+  vector<SMeshProxy> proxies(shadowProxies.size());
+  for (int i = 0; i < shadowProxies.size(); i++)
+  {
+    const Model& proxy = *shadowProxies[i].model;
+    proxies[i].vertCount = proxy.realVerts.size();
+    proxies[i].faceCount = proxy.faceArray.size();
+    proxies[i].edgeCount = proxy.edgeArray.size();
+    proxies[i].error     = shadowProxies[i].error;
+  }
+
+  if (proxies.size() > 0)
+    ok = ok && fwrite(&proxies[0], sizeof(SMeshProxy), proxies.size(), out) ==
+      proxies.size();
+
+  const vector<Vec3> *arrays[4] = { &realVerts, &vertArray, &normArray,
+    &textArray };
+
+  for (int i = 0; i < 4; i++)
+  {
+    if (arrays[i]->size() > 0)
+      ok = ok && fwrite(&(*arrays[i])[0], sizeof(Vec3), arrays[i]->size(),
+          out) == arrays[i]->size();
+  }
+
+  if (elemArray.size() > 0)
+    ok = ok && fwrite(&elemArray[0], sizeof(uint), elemArray.size(), out) ==
+      elemArray.size();
+
+  ok = ok && writeFaces(out, faceArray) && writeEdges(out, edgeArray);
+
+  for (int i = 0; i < shadowProxies.size(); i++)
+  {
+    const Model& proxy = *shadowProxies[i].model;
+
+    if (proxy.realVerts.size() > 0)
+      ok = ok && fwrite(&proxy.realVerts[0], sizeof(Vec3),
+          proxy.realVerts.size(), out) == proxy.realVerts.size();
+
+    ok = ok && writeFaces(out, proxy.faceArray) &&
+      writeEdges(out, proxy.edgeArray);
+  }
+
+  if (textureName.size() > 0)
+    ok = ok && fwrite(textureName.data(), 1, textureName.size(), out) ==
+      textureName.size();
+
+  ok = (fclose(out) == 0) && ok;
+
+  if (!ok || rename(temp.c_str(), path.c_str()) != 0)
+  {
+    remove(temp.c_str());
+    return false;
+  }
+
+  return true;
+}
@@ -78,7 +78,8 @@ void display()
   glNormalPointer  (   GL_FLOAT, sizeof(Vec3), model->getNormalPointer());
   glTexCoordPointer(2, GL_FLOAT, sizeof(Vec3), model->getTexCoordPointer());
 
-  //glDrawArrays(GL_TRIANGLES, 0, model->getVertexCount());
+  //glDrawElements(GL_TRIANGLES, model->getElementCount(), GL_UNSIGNED_INT,
+  //    model->getElementPointer());
 
 // ----------------------------------------------------------------------------
 // Silhouette Calculations.
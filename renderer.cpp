@@ -10,16 +10,35 @@
 
 #include <OpenGL/gl.h>
 #include <OpenGL/glu.h>
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
 
 #include "model/model.h"
 #include "material/shader.h"
 #include "material/texture.h"
 #include "font/font.h"
+#include "streambuffer.h"
+#include "shadowcompute.h"
+#include "math/frustum.h"
+
+
+// Initial size of the shadow volume index stream, it grows when needed.
+static const GLsizeiptr VOLUME_BUFFER_SIZE = 4 * 1024 * 1024;
+
+// Frames a shadow volume must stay the same before it gets its own buffer.
+static const int STATIC_VOLUME_FRAMES = 2;
 
 
 Global global;
 
 
+// The perspective projection used for the scene.
+static const float FIELD_OF_VIEW = 45.0f;
+static const float NEAR_PLANE    = 0.1f;
+static const float FAR_PLANE     = 128.0f;
+
+
 //
 // This functions uses changed a little over time. In it's present form, this
 // function prints a side by side comparison of the current Modelview Matrix
@@ -106,7 +125,29 @@ Renderer::Renderer (void)
 
   extrudeShader = new ShaderProgram("extrude", "data/shaders/extrude.vert",
       "");
+  lightShader = new ShaderProgram("light", "data/shaders/light.vert", "");
+
+  volumeShader = new ShaderProgram("volume", "data/shaders/volume.vert",
+      "data/shaders/volume.geom", "");
+  if (!volumeShader->isLinked())
+    printf("No geometry shaders, shadow volumes are only found on the CPU.\n");
+
+  shadowCompute = new ShadowCompute();
+  if (!shadowCompute->isAvailable())
+    printf("No compute shaders, shadow volumes are only found on the CPU.\n");
+
+#ifdef GL_EXT_depth_bounds_test
+  const char *extensions = (const char *) glGetString(GL_EXTENSIONS);
+  depthBounds = extensions && strstr(extensions, "GL_EXT_depth_bounds_test");
+#else
+  depthBounds = false;
+#endif
+  if (!depthBounds)
+    printf("No depth bounds test, lights are only limited by scissoring.\n");
+
   font = new Font("data/vera.ttf", 32);
+
+  volumeBuffer = new StreamBuffer(GL_ELEMENT_ARRAY_BUFFER, VOLUME_BUFFER_SIZE);
 }
 
 
@@ -116,7 +157,162 @@ Renderer::Renderer (void)
 Renderer::~Renderer (void)
 {
   delete extrudeShader;
+  delete lightShader;
+  delete volumeShader;
+  delete shadowCompute;
   delete font;
+  delete volumeBuffer;
+
+  for (int i = 0; i < staticVolumes.size(); i++)
+    if (staticVolumes[i].buffer)
+      glDeleteBuffers(1, &staticVolumes[i].buffer);
+}
+
+
+//
+// The camera's view frustum in world space.
+//
+void Renderer::buildFrustum (Camera& camera, Frustum& frustum) const
+{
+  frustum.build(invertMatrix(camera.getWorldToCamMatrix()), FIELD_OF_VIEW,
+      (float) global.winWidth / global.winHeight, NEAR_PLANE, FAR_PLANE);
+}
+
+
+//
+// Picks the shadow proxy each caster's shadows are found from this frame,
+// by how many pixels the proxies' errors would cover at the caster's
+// distance. The nearest point of its bounding sphere is used, so a proxy is
+// never chosen for a caster which is closer than it looks. With proxies
+// turned off, only ones without any error at all are used.
+//
+void Renderer::chooseShadowProxies (Scene& scene, Camera& camera)
+{
+  // Pixels covered by a unit at a distance of one.
+  float focal = 1.0f / tan(FIELD_OF_VIEW * M_PI / 360.0f);
+  float scale = 0.5f * global.winHeight * focal;
+
+  const Matrix& worldToCam = camera.getWorldToCamMatrix();
+
+  for (vector<Caster>::iterator caster = scene.casters.begin();
+      caster != scene.casters.end(); ++caster)
+  {
+    if (!caster->isCaster())
+      continue;
+
+    Vec3 center;
+    float radius;
+    caster->getBoundingSphere(center, radius);
+    worldToCam.transform(center);
+
+    // Eye space looks down -z.
+    float dist = std::max(-center.z - radius, NEAR_PLANE);
+
+    caster->chooseShadowProxy(global.shadowProxies ? scale / dist : FLT_MAX);
+  }
+}
+
+
+//
+// Works out which casters can throw a shadow onto something visible for
+// each light drawn this frame. A caster's bounding sphere is tested against
+// the view frustum stretched back to include the light, anything outside of
+// it can only shadow things which are off screen. Casters out of a light's
+// range are culled too, as they can only shadow things which it doesn't
+// light. Culled shadows don't have their silhouettes found or their volumes
+// drawn.
+//
+void Renderer::cullShadows (Scene& scene, Camera& camera)
+{
+  int lights = scene.lights.size();
+  if (lights > global.maxVisibleLights)
+    lights = global.maxVisibleLights;
+
+  int casters = scene.casters.size();
+
+  Frustum frustum;
+  buildFrustum(camera, frustum);
+
+  vector<Vec3> centers(casters);
+  vector<float> radii(casters);
+  for (int i = 0; i < casters; i++)
+    scene.casters[i].getBoundingSphere(centers[i], radii[i]);
+
+  shadowVisible.assign(lights * casters, false);
+
+  for (int i = 0; i < lights; i++)
+  {
+    Vec3 planes[MAX_SHADOW_PLANES];
+    int count = frustum.extendToLight(scene.lights[i].getPosition(), planes);
+
+    for (int j = 0; j < casters; j++)
+    {
+      if (!scene.casters[j].isCaster())
+        continue;
+
+      bool visible = scene.lights[i].reaches(centers[j], radii[j]) &&
+          Frustum::sphereInside(planes, count, centers[j], radii[j]);
+
+      shadowVisible[i * casters + j] = visible;
+      global.stats.shadowVolumes++;
+      if (!visible)
+        global.stats.culledVolumes++;
+    }
+  }
+}
+
+
+//
+// Works out the silhouettes and shadow volumes of every caster for every
+// light that will be drawn this frame, spread over the thread pool. This is
+// done before any drawing so the GL calls later only have to send the
+// results. Shadows which haven't changed since last frame are already in
+// each caster's cache, so only moving casters and lights need any jobs.
+// Culled shadows are skipped too.
+//
+void Renderer::prepareShadows (Scene& scene)
+{
+  int lights = scene.lights.size();
+  if (lights > global.maxVisibleLights)
+    lights = global.maxVisibleLights;
+
+  int casters = scene.casters.size();
+
+  shadowJobs.clear();
+
+  for (vector<Caster>::iterator caster = scene.casters.begin();
+      caster != scene.casters.end(); ++caster)
+  {
+    if (!caster->isCaster())
+      continue;
+
+    caster->reserveShadows(lights);
+    Matrix worldToLocal = invertMatrix(caster->getLocalToWorldMatrix());
+    int index = caster - scene.casters.begin();
+
+    for (int i = 0; i < lights; i++)
+    {
+      if (!shadowVisible[i * casters + index])
+        continue;
+
+      ShadowJob job;
+      job.caster   = &(*caster);
+      job.lightPos = scene.lights[i].getPosition();
+      job.light    = i;
+      job.incremental = global.incrementalSilhouettes;
+      worldToLocal.transform(job.lightPos);
+
+      if (!caster->hasShadow(job.lightPos, i))
+        shadowJobs.push_back(job);
+    }
+  }
+
+  ThreadPool& pool = ThreadPool::getShared();
+  JobGroup group;
+
+  for (int i = 0; i < shadowJobs.size(); i++)
+    pool.submit(&shadowJobs[i], group);
+  pool.wait(group);
 }
 
 
@@ -125,6 +321,30 @@ Renderer::~Renderer (void)
 //
 void Renderer::drawScene(Scene& scene, Camera& camera)
 {
+  global.stats.shadowVolumes = 0;
+  global.stats.culledVolumes = 0;
+  global.stats.zPassVolumes  = 0;
+  global.stats.zFailVolumes  = 0;
+  global.stats.silhouetteLoops = 0;
+  global.stats.savedIndexes = 0;
+  global.stats.proxyVolumes = 0;
+
+  if (!global.drawAmbientOnly && global.drawShadows)
+  {
+    chooseShadowProxies(scene, camera);
+
+    // The compute shaders handle every caster at once, so they don't cull.
+    if (usingShadowCompute())
+      shadowCompute->update(scene.casters);
+    else
+    {
+      cullShadows(scene, camera);
+
+      if (!usingVolumeShader())
+        prepareShadows(scene);
+    }
+  }
+
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | 
       GL_STENCIL_BUFFER_BIT);
 
@@ -151,19 +371,27 @@ void Renderer::drawScene(Scene& scene, Camera& camera)
       if (global.drawPointLights)
         drawLight(light);
 
+      // Only the part of the screen the light can reach needs its shadows
+      // and lighting drawn, or its stencil cleared afterwards.
+      LightBounds bounds;
+      if (!findLightBounds(light, camera, bounds))
+        continue;
+
+      limitToLight(bounds, true);
+
       // Determine shadows and light the scene.
       if (global.drawShadows)
       {
-        determineShadows(scene.casters, light, camera);
+        determineShadows(scene.casters, light, i, camera);
       }
       
       // Iluminate the scene fro this light.
-      illuminationPass(scene, camera);
+      illuminationPass(scene, light, camera);
 
 	glClear(GL_STENCIL_BUFFER_BIT);
+
+      limitToLight(bounds, false);
   	}
-  	
-    scene.dirtyAllCasters();
 	}
 
 	// Check for OpenGL errors.
@@ -182,7 +410,8 @@ void Renderer::resize (const uint& newWidth, const uint& newHeight) const
 
 	glMatrixMode(GL_PROJECTION);
 	glLoadIdentity();
-	gluPerspective(45.0, (GLfloat) newWidth / (GLfloat) newHeight, 0.1, 128.0);
+	gluPerspective(FIELD_OF_VIEW, (GLfloat) newWidth / (GLfloat) newHeight,
+      NEAR_PLANE, FAR_PLANE);
 
 	glMatrixMode(GL_MODELVIEW);
 	glLoadIdentity();
@@ -203,6 +432,126 @@ void Renderer::setupLight (const Light& light)
 }
 
 
+//
+// The screen space bounds of a light from its radius. Per axis, the
+// rectangle is bounded by the tangents from the eye to the light's sphere,
+// and the depth range comes from the sphere's nearest and furthest points.
+// Lights without a radius cover the whole window. Returns false if the
+// light can't reach anything on screen.
+//
+bool Renderer::findLightBounds (const Light& light, Camera& camera,
+    LightBounds& bounds) const
+{
+  bounds.x = 0;
+  bounds.y = 0;
+  bounds.width = global.winWidth;
+  bounds.height = global.winHeight;
+  bounds.zMin = 0.0f;
+  bounds.zMax = 1.0f;
+
+  if (!light.hasRange())
+    return true;
+
+  // Eye space looks down -z, dist is how far along the view the light is.
+  Vec3 center = light.getPosition();
+  camera.getWorldToCamMatrix().transform(center);
+  float dist = -center.z;
+  float radius = light.radius;
+
+  if (dist + radius <= NEAR_PLANE || dist - radius >= FAR_PLANE)
+    return false;
+
+  // Window depths for the nearest and furthest eye distances.
+  float zNear = std::max(dist - radius, NEAR_PLANE);
+  float zFar = std::min(dist + radius, FAR_PLANE);
+  float range = FAR_PLANE - NEAR_PLANE;
+
+  bounds.zMin = 0.5f + 0.5f * ((FAR_PLANE + NEAR_PLANE) / range -
+      2.0f * FAR_PLANE * NEAR_PLANE / (range * zNear));
+  bounds.zMax = 0.5f + 0.5f * ((FAR_PLANE + NEAR_PLANE) / range -
+      2.0f * FAR_PLANE * NEAR_PLANE / (range * zFar));
+
+  float focal = 1.0f / tan(FIELD_OF_VIEW * M_PI / 360.0f);
+  float aspect = (float) global.winWidth / global.winHeight;
+
+  float low[2], high[2];
+  float offset[2] = { center.x, center.y };
+  float scale[2] = { focal / aspect, focal };
+
+  for (int i = 0; i < 2; i++)
+  {
+    low[i] = -1.0f;
+    high[i] = 1.0f;
+
+    // The eye is inside the light's circle on this axis.
+    float d = sqrt(offset[i] * offset[i] + dist * dist);
+    if (d <= radius)
+      continue;
+
+    // Angles of the two tangents away from the view direction. Anything
+    // past 90 degrees is behind the eye.
+    float angle = atan2(offset[i], dist);
+    float spread = asin(radius / d);
+    float lowAngle = angle - spread;
+    float highAngle = angle + spread;
+
+    if (lowAngle >= M_PI / 2 || highAngle <= -M_PI / 2)
+      return false;
+
+    if (lowAngle > -M_PI / 2)
+      low[i] = std::max(-1.0f, (float) tan(lowAngle) * scale[i]);
+    if (highAngle < M_PI / 2)
+      high[i] = std::min(1.0f, (float) tan(highAngle) * scale[i]);
+
+    if (low[i] >= high[i])
+      return false;
+  }
+
+  int x0 = (int) floor(0.5f * (low[0] + 1.0f) * global.winWidth);
+  int x1 = (int) ceil(0.5f * (high[0] + 1.0f) * global.winWidth);
+  int y0 = (int) floor(0.5f * (low[1] + 1.0f) * global.winHeight);
+  int y1 = (int) ceil(0.5f * (high[1] + 1.0f) * global.winHeight);
+
+  bounds.x = x0;
+  bounds.y = y0;
+  bounds.width = x1 - x0;
+  bounds.height = y1 - y0;
+
+  return bounds.width > 0 && bounds.height > 0;
+}
+
+
+//
+// Turns on, or back off, scissoring and depth bounds testing to a light's
+// bounds. Everything drawn for the light is limited to them, and so is the
+// stencil clear afterwards.
+//
+void Renderer::limitToLight (const LightBounds& bounds,
+    const bool& enable) const
+{
+  if (!enable)
+  {
+    glDisable(GL_SCISSOR_TEST);
+#ifdef GL_EXT_depth_bounds_test
+    if (depthBounds)
+      glDisable(GL_DEPTH_BOUNDS_TEST_EXT);
+#endif
+    return;
+  }
+
+  glScissor(bounds.x, bounds.y, bounds.width, bounds.height);
+  glEnable(GL_SCISSOR_TEST);
+
+#ifdef GL_EXT_depth_bounds_test
+  if (depthBounds)
+  {
+    glDepthBoundsEXT(bounds.zMin, bounds.zMax);
+    glEnable(GL_DEPTH_BOUNDS_TEST_EXT);
+  }
+#endif
+}
+
+
 //
 // glVertex method for using the Vec3(4) class in this project.
 //
@@ -281,7 +630,7 @@ void Renderer::drawSilhouette(EdgeArray& sil) const
 // is no ambient light, the Dpeth Buffer information is still needed for later
 // shadow determination.
 //
-void Renderer::ambientPass (const Scene& scene, Camera& camera)
+void Renderer::ambientPass (Scene& scene, Camera& camera)
 {
 
 	glPushAttrib(GL_ALL_ATTRIB_BITS);
@@ -296,7 +645,7 @@ void Renderer::ambientPass (const Scene& scene, Camera& camera)
   // lighting.
 	for (int i = 0; i < scene.casters.size(); ++i)
 	{
-    Caster caster = scene.casters[i];
+    Caster& caster = scene.casters[i];
 
     glPushMatrix();
     glMultMatrix(caster.getLocalToWorldMatrix());
@@ -314,8 +663,8 @@ void Renderer::ambientPass (const Scene& scene, Camera& camera)
 //
 // The guts of the shadow determination algorithm.
 //
-void Renderer::determineShadows (vector<Caster> casters, const Light& light,
-    Camera& camera)
+void Renderer::determineShadows (vector<Caster>& casters, const Light& light,
+    const int& lightIndex, Camera& camera)
 {
   glPushAttrib(GL_ALL_ATTRIB_BITS);
 
@@ -338,11 +687,36 @@ void Renderer::determineShadows (vector<Caster> casters, const Light& light,
     glColorMask(0, 0, 0, 0);
   }
 
+  // The compute shaders find and draw every caster's volume at once, in
+  // world space, with the same z-fail stencil operations as below.
+  if (usingShadowCompute())
+  {
+    setStencilOp(GL_DECR_WRAP, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+    shadowCompute->drawVolumes(light.getPosition());
+
+    glPopAttrib();
+    return;
+  }
+
+  // Casters outside of the pyramid between the light and the near plane
+  // can't have their volumes clipped by it, so the cheaper z-pass method
+  // works for them.
+  Frustum frustum;
+  buildFrustum(camera, frustum);
+
+  Vec3 pyramid[5];
+  int pyramidPlanes = frustum.nearLightPyramid(light.getPosition(), pyramid);
+
+  if (staticVolumes.size() < (lightIndex + 1) * casters.size())
+    staticVolumes.resize((lightIndex + 1) * casters.size());
   
   for (vector<Caster>::iterator caster = casters.begin();
       caster != casters.end(); ++caster)
   {
-    if (!caster->isCaster())
+    int index = caster - casters.begin();
+
+    if (!caster->isCaster() ||
+        !shadowVisible[lightIndex * casters.size() + index])
       continue;
     
     // Get the matricies required to draw the caster, and load a matrix which
@@ -353,33 +727,93 @@ void Renderer::determineShadows (vector<Caster> casters, const Light& light,
 
     // Transform the light position into object (or local) space by inverting
     // the localToWorld matrix and transforming the light position.
+    Matrix worldToLocal = invertMatrix(localToWorld);
     Vec3 lightPosLocal = light.getPosition();
-    invertMatrix(localToWorld).transform(lightPosLocal);
+    worldToLocal.transform(lightPosLocal);
+
+    Vec3 farPlane = caster->findFarPlane(light, worldToLocal);
+
+    Vec3 center;
+    float radius;
+    caster->getBoundingSphere(center, radius);
+
+    // Padded a little for the near plane's own thickness.
+    bool zFail = pyramidPlanes == 0 || Frustum::sphereInside(pyramid,
+        pyramidPlanes, center, radius + NEAR_PLANE);
+
+    if (zFail)
+      global.stats.zFailVolumes++;
+    else
+      global.stats.zPassVolumes++;
+
+    if (caster->getProxyLevel() > 0)
+      global.stats.proxyVolumes++;
+
+    // z-pass counts the volume's faces in front of the scene, z-fail
+    // (Carmack's reverse) counts those behind it. z-fail needs both caps
+    // but works even when the volume is cut by the near plane. z-pass only
+    // needs the dark cap if the volume stops short of infinity.
+    if (zFail)
+      setStencilOp(GL_DECR_WRAP, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+    else
+      setStencilOp(GL_KEEP, GL_INCR_WRAP, GL_KEEP, GL_DECR_WRAP);
+
+    // Only the shadow comes from the proxy, the caster itself is still drawn
+    // and lit from its full model.
+    Model *shadowModel = caster->getShadowModel();
+    shadowModel->bindExtrudeBuffer();
 
+    if (usingVolumeShader())
+    {
+      // The geometry shader finds the whole volume from the model's faces
+      // and their neighbours, so there's nothing to do on the CPU. It adds
+      // the dark cap by itself for volumes which stop at the far plane.
+      // drawShadowFaces() binds the face planes and neighbours to units 0
+      // and 1.
+      volumeShader->useProgram();
+      glUniform4f(glGetUniformLocation(volumeShader->getId(), "lightPos"),
+          lightPosLocal.x, lightPosLocal.y, lightPosLocal.z, lightPosLocal.w);
+      glUniform4fv(glGetUniformLocation(volumeShader->getId(), "farPlane"), 1,
+          farPlane.v);
+      glUniform1i(glGetUniformLocation(volumeShader->getId(), "caps"), zFail);
+      glUniform1i(glGetUniformLocation(volumeShader->getId(), "planes"), 0);
+      glUniform1i(glGetUniformLocation(volumeShader->getId(), "neighbours"),
+          1);
+
+      shadowModel->drawShadowFaces();
+
+      volumeShader->disableProgram();
+
+      glPopMatrix();
+      continue;
+    }
 
-    caster->getModel()->bindExtrudeBuffer();
+    // Already worked out by prepareShadows() unless this is a new light.
+    const ShadowCache& shadow = caster->getShadowCache(lightPosLocal,
+        lightIndex, global.incrementalSilhouettes);
 
     // Setup the shader program for use.
     extrudeShader->useProgram();
     glUniform4f(glGetUniformLocation(extrudeShader->getId(), "lightPos"),
         lightPosLocal.x, lightPosLocal.y, lightPosLocal.z, lightPosLocal.w);
+    glUniform4fv(glGetUniformLocation(extrudeShader->getId(), "farPlane"), 1,
+        farPlane.v);
+
+    bool darkCap = zFail || farPlane.w > 0.0f;
+    StaticVolume& stored = staticVolumes[lightIndex * casters.size() + index];
+    drawShadowVolume(shadow, stored, zFail, darkCap);
+
+    // Compared with two triangles per silhouette edge for the sides (one
+    // for directional lights) and one for the dark cap.
+    int edges = shadow.silhouette.size();
+    int saved = (lightPosLocal.w > 0 ? 6 : 3) * edges - shadow.darkCapStart;
+
+    if (darkCap && lightPosLocal.w > 0)
+      saved += 3 * edges - (shadow.lightCapStart - shadow.darkCapStart);
+
+    global.stats.silhouetteLoops += shadow.sideCounts.size();
+    global.stats.savedIndexes += saved;
 
-    // TODO: Add z-Fail testing here.
-    // z-Pass algorithm.
-    //setStencilOp(GL_KEEP, GL_INCR_WRAP, GL_KEEP, GL_DECR_WRAP);
-    //drawVolumeSides(lightPosLocal, *caster);
-    
-    // z-fail method (Carmacks Reverse). Works for nearly all situations but
-    // isn't as efficient as the z-pass method above as it draws both the
-    // front and back caps whereas the other methods doesn't require this.
-    if (1)
-    {
-      setStencilOp(GL_DECR_WRAP, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
-      drawVolumeSides(lightPosLocal, *caster);
-      drawDarkCap(lightPosLocal, *caster);
-      drawLightCap(lightPosLocal, *caster);
-    }
-    
     /*
 
     // This is an alternative method for drawing the shadow volumes which
@@ -390,11 +824,11 @@ void Renderer::determineShadows (vector<Caster> casters, const Light& light,
     
     glCullFace(GL_BACK);
     glStencilOp(GL_KEEP, GL_KEEP, GL_INCR);
-    drawVolumeSides(lightPosLocal, *caster);
+    drawShadowVolume(shadow, stored, false, false);
     
     glCullFace(GL_FRONT);
     glStencilOp(GL_KEEP, GL_KEEP, GL_DECR);
-    drawVolumeSides(lightPosLocal, *caster);
+    drawShadowVolume(shadow, stored, false, false);
 
     */
     
@@ -408,98 +842,125 @@ void Renderer::determineShadows (vector<Caster> casters, const Light& light,
 
 
 //
-// This function does the actual drawing of the shadow volume sides.
+// Draws a run of strips or fans from the bound index buffer, one for each
+// count, starting offset bytes into the buffer.
 //
-void Renderer::drawVolumeSides (const Vec3& lightPos, Caster& caster)
+void Renderer::drawVolumeRuns (const GLenum& mode,
+    const vector<GLsizei>& counts, GLintptr offset)
 {
-  glPushAttrib(GL_ALL_ATTRIB_BITS);
-  glDisable(GL_LIGHTING);
+  if (counts.empty())
+    return;
+
+  volumeOffsets.resize(counts.size());
+
+  for (int i = 0; i < counts.size(); i++)
+  {
+    volumeOffsets[i] = (const GLvoid *) offset;
+    offset += sizeof(GLuint) * counts[i];
+  }
+
+  glMultiDrawElements(mode, &counts[0], GL_UNSIGNED_INT, &volumeOffsets[0],
+      counts.size());
+}
 
-  Model *model = caster.getModel();
-  EdgeArray& sil = caster.getSilhouette(lightPos);
 
+//
+// Draws the shadow volume of a caster, with or without each of its caps.
+// The strips and fans come ready made from the caster's ShadowCache and are
+// drawn from the extrude buffer which must already be bound. The sides and
+// the dark cap are one multi-draw each, the light cap needs a different
+// depth function so it gets a third.
+//
+// Most volumes don't change from one frame to the next. Once a volume has
+// stayed the same for a few frames the whole of it is kept in its own index
+// buffer, and it isn't sent again until it changes. Others are streamed to
+// the GL every frame.
+//
+void Renderer::drawShadowVolume (const ShadowCache& shadow,
+    StaticVolume& stored, const bool& lightCap, const bool& darkCap)
+{
+  // The sides are sent followed by the dark cap if it's wanted. The light
+  // cap is never drawn without the dark cap.
+  int first = (darkCap || lightCap) ? shadow.lightCapStart :
+      shadow.darkCapStart;
+  int count = lightCap ? shadow.volume.size() : first;
 
-  int offset = model->getRealVertexCount();
+  if (count == 0)
+    return;
 
-  // Draw the shadow volume sides.
-  for (vector<Edge>::const_iterator edge = sil.begin();
-      edge != sil.end(); ++edge)
+  if (stored.volumeId != shadow.volumeId)
   {
-    // For point lights.
-    if (lightPos.w > 0)
-    {
-      model->drawIndexQuad(edge->v1, edge->v2,
-          edge->v2 + offset, edge->v1 + offset);
-      
-      /*
-      // This is the non-VBO Method of Volume drawing.
-       
-      Vec3& v1 = edge->getVertex(0);
-      Vec3& v2 = edge->getVertex(1);
-      Vec3  i1(edge->getVertex(0), 0.0f);
-      Vec3  i2(edge->getVertex(1), 0.0f);
+    stored.volumeId = shadow.volumeId;
+    stored.frames = 0;
+    stored.uploaded = false;
+  }
+  else if (stored.frames < STATIC_VOLUME_FRAMES)
+    stored.frames++;
 
-      glBegin(GL_QUADS);
+  glPushAttrib(GL_ALL_ATTRIB_BITS);
+  glDisable(GL_LIGHTING);
 
-      glVertex(v1);
-      glVertex(v2);
-      glVertex(i2);
-      glVertex(i1);
+  GLintptr offset = 0;
 
-      glEnd();
-      */
-    }
-    // For directional lights.
-    else
-    {
-      model->drawIndexTri(edge->v1, edge->v2,
-          offset);
-    }
+  if (stored.frames < STATIC_VOLUME_FRAMES)
+  {
+    offset = volumeBuffer->write(&shadow.volume[0], sizeof(GLuint) * count);
+  }
+  else if (!stored.uploaded)
+  {
+    if (!stored.buffer)
+      glGenBuffers(1, &stored.buffer);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stored.buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+        sizeof(GLuint) * shadow.volume.size(), &shadow.volume[0],
+        GL_STATIC_DRAW);
+    stored.uploaded = true;
+  }
+  else
+  {
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stored.buffer);
+  }
+
+  drawVolumeRuns(shadow.sideMode, shadow.sideCounts, offset);
+
+  if (darkCap || lightCap)
+  {
+    drawVolumeRuns(GL_TRIANGLE_FAN, shadow.capCounts,
+        offset + sizeof(GLuint) * shadow.darkCapStart);
+  }
+
+  if (count > first)
+  {
+    glDepthFunc(GL_NEVER);
+    glDrawElements(GL_TRIANGLES, count - first, GL_UNSIGNED_INT,
+        (const GLvoid *) (offset + sizeof(GLuint) * first));
   }
 
+  volumeBuffer->unbind();
+
   glPopAttrib();
 }
 
 
 //
-// Draws the Dark cap (cap at infinity) of a shadow volume.
+// True if shadow volumes should be found by the geometry shader rather than
+// on the CPU. Falls back to the CPU when geometry shaders aren't supported.
 //
-void Renderer::drawDarkCap (const Vec3& lightPos, Caster& caster)
+bool Renderer::usingVolumeShader (void) const
 {
-  // Directional lights come to a point.
-  if (lightPos.w == 0.0f)
-    return;
-  
-  EdgeArray& sil = caster.getSilhouette(lightPos);
-  Model *model = caster.getModel();
-  int offset = model->getRealVertexCount();
-
-  for (EdgeArray::iterator edge = sil.begin();
-      edge != sil.end(); ++edge)
-  {
-    caster.getModel()->drawIndexTri(offset, edge->v1 + offset,
-        edge->v2 + offset);
-  }
+  return global.volumeMethod == VOLUMES_GEOMETRY && volumeShader->isLinked();
 }
 
 
 //
-// Draws the light cap (cap at the front) of a shadow volume. Simply loops
-// through all the faces in a model and draws those which are light facing,
-// ie, the light cap!
+// True if shadow volumes should be found by the compute shaders, again only
+// if they are supported.
 //
-void Renderer::drawLightCap (const Vec3& lightPos, Caster& caster)
+bool Renderer::usingShadowCompute (void) const
 {
-  Model *model = caster.getModel();
-
-  glDepthFunc(GL_NEVER);
-  for (vector<Face>::iterator face = model->faceArray.begin();
-      face != model->faceArray.end(); ++face)
-  {
-    if (face->lightFacing)
-      model->drawIndexTri(face->index[0], face->index[1], face->index[2]);
-  }
-  glDepthFunc(GL_LESS);
+  return global.volumeMethod == VOLUMES_COMPUTE &&
+      shadowCompute->isAvailable();
 }
 
 
@@ -507,9 +968,11 @@ void Renderer::drawLightCap (const Vec3& lightPos, Caster& caster)
 // The final illumination pass for any single light. This pass sets the blend
 // function to GL_ONE GL_ONE so that fragments are essentially added together
 // with the fragments from the ambient pass. The stencil function is set to
-// pass when a stencil fragment equals 0.
+// pass when a stencil fragment equals 0. Casters out of the light's range
+// aren't drawn at all.
 //
-void Renderer::illuminationPass(const Scene& scene, Camera& camera)
+void Renderer::illuminationPass(Scene& scene, const Light& light,
+    Camera& camera)
 {
   glPushAttrib(GL_ALL_ATTRIB_BITS);
 
@@ -526,10 +989,20 @@ void Renderer::illuminationPass(const Scene& scene, Camera& camera)
   glBlendFunc(GL_ONE, GL_ONE);                // Additive blending.
   glEnable(GL_LIGHT0);                        // The required light.
 
+  lightShader->useProgram();
+  glUniform1f(glGetUniformLocation(lightShader->getId(), "lightRadius"),
+      light.hasRange() ? light.radius : 0.0f);
+
   // Loop through all casters in the scene and draw them.
 	for (int i = 0; i < scene.casters.size(); ++i)
 	{
-    Caster caster = scene.casters[i];
+    Caster& caster = scene.casters[i];
+
+    Vec3 center;
+    float radius;
+    caster.getBoundingSphere(center, radius);
+    if (!light.reaches(center, radius))
+      continue;
 
     glPushMatrix();
     glMultMatrix(caster.getLocalToWorldMatrix());
@@ -541,6 +1014,8 @@ void Renderer::illuminationPass(const Scene& scene, Camera& camera)
     glPopMatrix();
 	}
 
+  lightShader->disableProgram();
+
   glPopAttrib();
 }
 
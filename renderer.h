@@ -20,6 +20,7 @@ using std::string;
 #include "math/matrix.h"
 #include "model/camera.h"
 #include "model/scene.h"
+#include "thread/threadpool.h"
 
 
 // Global global instance in renderer.cpp :)
@@ -27,9 +28,60 @@ extern Global global;
 
 
 class ShaderProgram;
+class StreamBuffer;
+class ShadowCompute;
+class Frustum;
 class Font;
 
 
+//
+// Finds the shadow of one caster for one light on the thread pool.
+//
+class ShadowJob : public Job
+{
+
+public:
+
+  Caster *caster;
+  Vec3 lightPos;
+  int light;
+  bool incremental;
+
+  void run (void)
+  { caster->getShadowCache(lightPos, light, incremental); }
+
+};
+
+
+//
+// The part of the window a light can affect, and the range of window depths
+// in it, as used by glScissor() and glDepthBoundsEXT().
+//
+struct LightBounds
+{
+  int x, y, width, height;
+  float zMin, zMax;
+};
+
+
+//
+// A caster's shadow volume for one light, kept in its own index buffer on
+// the GL once it has stayed the same for a few frames. See
+// drawShadowVolume().
+//
+struct StaticVolume
+{
+  GLuint buffer;
+  int volumeId;                 // ShadowCache::volumeId last drawn.
+  int frames;                   // Frames in a row it's been the same.
+  bool uploaded;
+
+  StaticVolume (void)
+    : buffer(0), volumeId(0), frames(0), uploaded(false)
+  { }
+};
+
+
 class Renderer
 {
 
@@ -40,19 +92,61 @@ private:
     const GLenum& backDepthPass);
 
   void setupLight (const Light& light);
+  bool findLightBounds (const Light& light, Camera& camera,
+      LightBounds& bounds) const;
+  void limitToLight (const LightBounds& bounds, const bool& enable) const;
   static void drawLight (const Light& light);
-  void ambientPass (const Scene& scene, Camera& camera);
-  void determineShadows (vector<Caster> casters, const Light& light,
-      Camera& camera);
-  void illuminationPass (const Scene& scene, Camera& camera);
+  void buildFrustum (Camera& camera, Frustum& frustum) const;
+  void chooseShadowProxies (Scene& scene, Camera& camera);
+  void cullShadows (Scene& scene, Camera& camera);
+  void prepareShadows (Scene& scene);
+  void ambientPass (Scene& scene, Camera& camera);
+  void determineShadows (vector<Caster>& casters, const Light& light,
+      const int& lightIndex, Camera& camera);
+  void illuminationPass (Scene& scene, const Light& light, Camera& camera);
 
   void drawSilhouette (EdgeArray& sil) const;
-  void drawVolumeSides (const Vec3& lightPos, Caster& caster);
-  void drawDarkCap (const Vec3& lightPos, Caster& caster);
-  void drawLightCap (const Vec3& lightPos, Caster& caster);
+  void drawShadowVolume (const ShadowCache& shadow, StaticVolume& stored,
+      const bool& lightCap, const bool& darkCap);
+  void drawVolumeRuns (const GLenum& mode, const vector<GLsizei>& counts,
+      GLintptr offset);
+
+  bool usingVolumeShader (void) const;
+  bool usingShadowCompute (void) const;
 
   // Shader Program for extrudeing vertices.
   ShaderProgram *extrudeShader;
+
+  // Lights the scene like the fixed function pipeline, but with lights which
+  // fade out completely at their radius.
+  ShaderProgram *lightShader;
+
+  // Shader Program which finds whole shadow volumes on the GPU, only linked
+  // if geometry shaders are supported.
+  ShaderProgram *volumeShader;
+
+  // Finds every caster's shadow volume at once with compute shaders, if
+  // they are supported.
+  ShadowCompute *shadowCompute;
+
+  // True if EXT_depth_bounds_test is supported.
+  bool depthBounds;
+
+  // Shadow volume triangles are streamed through this to the GL.
+  StreamBuffer *volumeBuffer;
+
+  // One job per caster and light, kept to save reallocating every frame.
+  vector<ShadowJob> shadowJobs;
+
+  // Byte offsets of each strip or fan in a multi-draw, see drawVolumeRuns().
+  vector<const GLvoid *> volumeOffsets;
+
+  // Shadow volumes which don't change, indexed by light * casters + caster.
+  vector<StaticVolume> staticVolumes;
+
+  // Whether each caster's shadow can be seen for each light this frame,
+  // indexed by light * casters + caster. See cullShadows().
+  vector<bool> shadowVisible;
   
   // Font object for rendering text to the screen.
   Font *font;
@@ -0,0 +1,343 @@
+//
+// shadowcompute.cpp
+//
+// ShadowCompute implementation.
+//
+
+
+#include "shadowcompute.h"
+#include "model/caster.h"
+#include "material/shader.h"
+
+#include <algorithm>
+
+
+#ifdef GL_VERSION_4_3
+
+// Threads per work group, local_size_x in volume.comp.
+static const int GROUP_SIZE = 64;
+
+
+//
+// Allocates a buffer's storage and fills it from a vector.
+//
+template <class T>
+static void uploadBuffer (const GLuint& buffer, const vector<T>& data,
+    const GLenum& usage)
+{
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(T) * data.size(),
+      data.size() > 0 ? &data[0] : NULL, usage);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+
+ShadowCompute::ShadowCompute (void)
+  : maxVerts(0), maxFaces(0), maxEdges(0)
+{
+  computeShader = new ShaderProgram("volume compute",
+      "data/shaders/volume.comp");
+  drawShader = new ShaderProgram("volume draw",
+      "data/shaders/volumedraw.vert", "");
+
+  glGenBuffers(BUFFER_COUNT, buffers);
+}
+
+
+ShadowCompute::~ShadowCompute (void)
+{
+  glDeleteBuffers(BUFFER_COUNT, buffers);
+
+  delete computeShader;
+  delete drawShader;
+}
+
+
+//
+// True if both shader programs linked, which needs OpenGL 4.3.
+//
+bool ShadowCompute::isAvailable (void) const
+{
+  return computeShader->isLinked() && drawShader->isLinked();
+}
+
+
+//
+// Copies the vertexes, face planes and edges of a model onto the ends of
+// the mesh arrays.
+//
+void ShadowCompute::addModel (Model *model, vector<Vec3>& meshVerts,
+    vector<FaceData>& faces, vector<GLint>& edges)
+{
+  const SilhouetteData& data = model->silhouetteData;
+
+  models.push_back(model);
+  vertBase.push_back(meshVerts.size());
+  faceBase.push_back(faces.size());
+  edgeBase.push_back(edges.size() / 4);
+
+  meshVerts.insert(meshVerts.end(), model->realVerts.begin(),
+      model->realVerts.end());
+
+  for (int f = 0; f < model->faceCount(); f++)
+  {
+    FaceData face;
+    face.plane[0] = data.nx[f];
+    face.plane[1] = data.ny[f];
+    face.plane[2] = data.nz[f];
+    face.plane[3] = data.d[f];
+
+    for (int k = 0; k < 3; k++)
+      face.index[k] = model->faceArray[f].index[k];
+    face.index[3] = 0;
+
+    faces.push_back(face);
+  }
+
+  for (EdgeArray::const_iterator edge = model->edgeArray.begin();
+      edge != model->edgeArray.end(); ++edge)
+  {
+    edges.push_back(edge->v1);
+    edges.push_back(edge->v2);
+    edges.push_back(edge->f1);
+    edges.push_back(edge->f2);
+  }
+}
+
+
+//
+// Points a caster's mesh ranges at one of the models in the mesh buffers.
+//
+void ShadowCompute::useModel (CasterData& c, Model *model) const
+{
+  int m = std::find(models.begin(), models.end(), model) - models.begin();
+
+  c.verts[1] = vertBase[m];
+  c.verts[2] = model->getRealVertexCount();
+  c.faces[0] = faceBase[m];
+  c.faces[1] = model->faceCount();
+  c.edges[0] = edgeBase[m];
+  c.edges[1] = model->edgeArray.size();
+}
+
+
+//
+// Copies the vertexes, face planes and edges of every model used by the
+// casters into the mesh buffers, along with their shadow proxies, each
+// model only once however many casters use it, and sizes the per caster
+// buffers. A caster's share of those is sized for its full model, which
+// its proxies all fit in. The index buffer has room for the worst case of
+// every face giving both caps and every edge a side.
+//
+void ShadowCompute::build (void)
+{
+  vector<Vec3> meshVerts;
+  vector<FaceData> faces;
+  vector<GLint> edges;
+
+  models.clear();
+  vertBase.clear();
+  faceBase.clear();
+  edgeBase.clear();
+  casterData.resize(casters.size());
+  maxVerts = maxFaces = maxEdges = 0;
+
+  int worldVerts = 0, facing = 0, indexCount = 0;
+
+  for (int i = 0; i < casters.size(); i++)
+  {
+    Model *model = casters[i]->getModel();
+
+    if (std::find(models.begin(), models.end(), model) == models.end())
+    {
+      addModel(model, meshVerts, faces, edges);
+
+      for (int p = 0; p < model->shadowProxies.size(); p++)
+        addModel(model->shadowProxies[p].model, meshVerts, faces, edges);
+    }
+
+    int vertCount = model->getRealVertexCount();
+    int faceCount = model->faceCount();
+    int edgeCount = model->edgeArray.size();
+
+    CasterData& c = casterData[i];
+    c.verts[0] = worldVerts;
+    c.verts[3] = 0;
+    c.faces[2] = facing;
+    c.faces[3] = 0;
+    c.edges[2] = c.edges[3] = 0;
+    useModel(c, casters[i]->getShadowModel());
+
+    worldVerts += vertCount;
+    facing     += faceCount;
+    indexCount += 6 * (faceCount + edgeCount);
+
+    maxVerts = std::max(maxVerts, vertCount);
+    maxFaces = std::max(maxFaces, faceCount);
+    maxEdges = std::max(maxEdges, edgeCount);
+  }
+
+  uploadBuffer(buffers[MESH_VERTS], meshVerts, GL_STATIC_DRAW);
+  uploadBuffer(buffers[FACES], faces, GL_STATIC_DRAW);
+  uploadBuffer(buffers[EDGES], edges, GL_STATIC_DRAW);
+  uploadBuffer(buffers[CASTERS], casterData, GL_DYNAMIC_DRAW);
+
+  uploadBuffer(buffers[WORLD_VERTS], vector<Vec3>(worldVerts),
+      GL_DYNAMIC_COPY);
+  uploadBuffer(buffers[FACING], vector<GLuint>(facing), GL_DYNAMIC_COPY);
+  uploadBuffer(buffers[COMMAND], vector<GLuint>(5), GL_DYNAMIC_DRAW);
+  uploadBuffer(buffers[INDICES], vector<GLuint>(indexCount),
+      GL_DYNAMIC_COPY);
+}
+
+
+//
+// Runs one stage of volume.comp over every caster, width threads each, and
+// waits for its results to be visible to the next stage. The compute
+// program must be in use.
+//
+void ShadowCompute::dispatch (const int& stage, const int& width)
+{
+  glUniform1i(glGetUniformLocation(computeShader->getId(), "stage"), stage);
+  glDispatchCompute((width + GROUP_SIZE - 1) / GROUP_SIZE, casters.size(), 1);
+  glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+
+//
+// Called once a frame before any volumes are drawn. Rebuilds the buffers if
+// the casters have changed, sends the caster matrices and the model or
+// proxy each one's shadow is found from, and moves every caster's vertexes
+// into world space.
+//
+void ShadowCompute::update (vector<Caster>& sceneCasters)
+{
+  vector<Caster *> current;
+  for (vector<Caster>::iterator caster = sceneCasters.begin();
+      caster != sceneCasters.end(); ++caster)
+  {
+    if (caster->isCaster())
+      current.push_back(&(*caster));
+  }
+
+  if (current != casters)
+  {
+    casters.swap(current);
+    build();
+  }
+
+  if (casters.size() == 0)
+    return;
+
+  for (int i = 0; i < casters.size(); i++)
+  {
+    const Matrix& localToWorld = casters[i]->getLocalToWorldMatrix();
+    Matrix worldToLocal = invertMatrix(localToWorld);
+
+    for (int j = 0; j < 16; j++)
+    {
+      casterData[i].localToWorld[j] = localToWorld.values[j];
+      casterData[i].worldToLocal[j] = worldToLocal.values[j];
+    }
+
+    useModel(casterData[i], casters[i]->getShadowModel());
+  }
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[CASTERS]);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0,
+      sizeof(CasterData) * casterData.size(), &casterData[0]);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  for (int i = 0; i < BUFFER_COUNT; i++)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, buffers[i]);
+
+  computeShader->useProgram();
+  dispatch(0, maxVerts);
+  computeShader->disableProgram();
+}
+
+
+//
+// Finds and draws the shadow volumes of every caster for a light, given in
+// world space. The stencil state is left to the caller. The volume is drawn
+// with the current modelview matrix, which should be the camera's.
+//
+void ShadowCompute::drawVolumes (const Vec3& lightPos)
+{
+  if (casters.size() == 0)
+    return;
+
+  // Count, instance count, first index, base vertex and base instance.
+  static const GLuint reset[5] = { 0, 1, 0, 0, 0 };
+
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[COMMAND]);
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(reset), reset);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  for (int i = 0; i < BUFFER_COUNT; i++)
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, buffers[i]);
+
+  computeShader->useProgram();
+  glUniform4f(glGetUniformLocation(computeShader->getId(), "lightPos"),
+      lightPos.x, lightPos.y, lightPos.z, lightPos.w);
+  dispatch(1, maxFaces);
+  dispatch(2, maxEdges);
+  computeShader->disableProgram();
+
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_ELEMENT_ARRAY_BARRIER_BIT);
+
+  // The vertexes all come from the shader storage, so no arrays are read.
+  glDisableClientState(GL_VERTEX_ARRAY);
+
+  drawShader->useProgram();
+  glUniform4f(glGetUniformLocation(drawShader->getId(), "lightPos"),
+      lightPos.x, lightPos.y, lightPos.z, lightPos.w);
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers[COMMAND]);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[INDICES]);
+  glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, 0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  drawShader->disableProgram();
+}
+
+
+#else // GL_VERSION_4_3
+
+
+// Without OpenGL 4.3 headers there is nothing to run the volumes on.
+
+ShadowCompute::ShadowCompute (void)
+  : computeShader(NULL), drawShader(NULL), maxVerts(0), maxFaces(0),
+    maxEdges(0)
+{ }
+
+
+ShadowCompute::~ShadowCompute (void)
+{ }
+
+
+bool ShadowCompute::isAvailable (void) const
+{
+  return false;
+}
+
+
+void ShadowCompute::build (void)
+{ }
+
+
+void ShadowCompute::dispatch (const int&, const int&)
+{ }
+
+
+void ShadowCompute::update (vector<Caster>&)
+{ }
+
+
+void ShadowCompute::drawVolumes (const Vec3&)
+{ }
+
+
+#endif // GL_VERSION_4_3
@@ -0,0 +1,107 @@
+//
+// shadowcompute.h
+//
+// Finds the shadow volumes of all of a scene's casters on the GPU with a
+// compute shader (data/shaders/volume.comp), and draws them with a single
+// indirect draw per light. The faces, edges and vertexes of every model are
+// copied into shader storage buffers once, and only the caster matrices are
+// sent each frame, so the CPU does the same small amount of work per light
+// however many casters there are. Each model's shadow proxies are copied
+// too, and a caster can switch to any of them between frames.
+//
+// Needs OpenGL 4.3. Without it isAvailable() is false and nothing else does
+// anything.
+//
+
+#ifndef _SHADOWCOMPUTE_H_
+#define _SHADOWCOMPUTE_H_
+
+#define GL_GLEXT_PROTOTYPES
+#include <OpenGL/gl.h>
+#include <vector>
+
+#include "math/vec3.h"
+
+using std::vector;
+
+
+class Caster;
+class Model;
+class ShaderProgram;
+
+
+class ShadowCompute
+{
+
+private:
+
+  // Shader storage bindings, see volume.comp.
+  enum
+  {
+    WORLD_VERTS,
+    MESH_VERTS,
+    FACES,
+    EDGES,
+    CASTERS,
+    FACING,
+    COMMAND,
+    INDICES,
+    BUFFER_COUNT
+  };
+
+  // Mirrors of the structures in volume.comp.
+  struct CasterData
+  {
+    GLfloat localToWorld[16];
+    GLfloat worldToLocal[16];
+    GLint verts[4];             // World base, mesh base, count.
+    GLint faces[4];             // Mesh base, count, facing base.
+    GLint edges[4];             // Mesh base, count.
+  };
+
+  struct FaceData
+  {
+    GLfloat plane[4];
+    GLint index[4];
+  };
+
+  ShaderProgram *computeShader;
+  ShaderProgram *drawShader;
+
+  GLuint buffers[BUFFER_COUNT];
+
+  // The casters and models the buffers were built for, and where each
+  // model starts in the mesh buffers.
+  vector<Caster *> casters;
+  vector<Model *> models;
+  vector<int> vertBase, faceBase, edgeBase;
+  vector<CasterData> casterData;
+
+  // Largest vertex, face and edge counts of any caster, for the size of the
+  // dispatches.
+  int maxVerts, maxFaces, maxEdges;
+
+  void build (void);
+  void addModel (Model *model, vector<Vec3>& meshVerts,
+      vector<FaceData>& faces, vector<GLint>& edges);
+  void useModel (CasterData& c, Model *model) const;
+  void dispatch (const int& stage, const int& width);
+
+  // Can't be copied.
+  ShadowCompute (const ShadowCompute&);
+  ShadowCompute& operator= (const ShadowCompute&);
+
+public:
+
+  ShadowCompute (void);
+  ~ShadowCompute (void);
+
+  bool isAvailable (void) const;
+
+  void update (vector<Caster>& sceneCasters);
+  void drawVolumes (const Vec3& lightPos);
+
+};
+
+
+#endif // _SHADOWCOMPUTE_H_
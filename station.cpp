@@ -17,11 +17,38 @@
 #include "model/camera.h"
 #include "model/scene.h"
 #include "obj/obj.h"
+#include "thread/threadpool.h"
 
 
 // Urgh...     ...anyway
 static ObjModel *interior, *cube, *sphere, *torus;
 
+// Model positions closer than this are welded together for the shadows, so
+// meshes exported with seams still cast closed volumes.
+static const float WELD_TOLERANCE = 0.0001f;
+
+// The spinning casters can use coarser shadow proxies than the rest, in
+// pixels as for Caster::setProxyTolerance(). Their shadows never hold still
+// long enough for the difference to show.
+static const float SPINNING_PROXY_TOLERANCE = 3.0f;
+
+
+//
+// Loads a single model file on one of the pool's threads.
+//
+class ModelLoadJob : public Job
+{
+
+public:
+
+  ObjModel *model;
+  const char *filename;
+
+  void run (void)
+  { model->loadFile(filename); }
+
+};
+
 
 Station::Station()
 {
@@ -32,11 +59,28 @@ Station::Station()
 
   // All the required models are loaded here for placement in the scene. Each
   // model only contains information that is relevant to all Casters that use
-  // a particular model.
-  interior = new ObjModel("data/models/interior.obj");
-	cube     = new ObjModel("data/models/cube.obj");
-  sphere   = new ObjModel("data/models/cylinder-nn.obj");
-  torus    = new ObjModel("data/models/ring.obj");
+  // a particular model. The files are parsed at the same time on the shared
+  // thread pool, the GL side is only set up afterwards on this thread.
+  interior = new ObjModel();
+  cube     = new ObjModel();
+  sphere   = new ObjModel();
+  torus    = new ObjModel();
+
+  ModelLoadJob loads[4];
+  loads[0].model = interior;  loads[0].filename = "data/models/interior.obj";
+  loads[1].model = cube;      loads[1].filename = "data/models/cube.obj";
+  loads[2].model = sphere;    loads[2].filename = "data/models/cylinder-nn.obj";
+  loads[3].model = torus;     loads[3].filename = "data/models/ring.obj";
+
+  ThreadPool& pool = ThreadPool::getShared();
+  JobGroup group;
+
+  for (int i = 0; i < 4; i++)
+  {
+    loads[i].model->setWeldTolerance(WELD_TOLERANCE);
+    pool.submit(&loads[i], group);
+  }
+  pool.wait(group);
 
   cube    ->initVertexBuffers();
   sphere  ->initVertexBuffers();
@@ -49,20 +93,24 @@ Station::Station()
   scene->addCaster(Caster(sphere, Vec3( 3.0, 11.0,  3.0), Vec3()));
   scene->addCaster(Caster(torus,  Vec3( 5.0, 12.0, -4.0), Vec3()));
 
+  scene->casters[1].setProxyTolerance(SPINNING_PROXY_TOLERANCE);
+  scene->casters[4].setProxyTolerance(SPINNING_PROXY_TOLERANCE);
+
   // The interior doesn't case any shadows...  they work, but kinda buggy, I
   // think something to do with the fact that they it's basically an inverted
   // model.
   scene->addCaster(Caster(interior, Vec3(), Vec3(), false));
 	
 	// Initialise the light setup here. The first two lights are animated, they
-	// just circle around a fixed path. The other lights are static.
-	//               Initial Light Position           Light Color
+	// just circle around a fixed path. The other lights are static, and only
+	// light their own corner of the room.
+	//               Initial Light Position           Light Color         Radius
 	Light light1(Vec3( 2.0f, 6.0f,  2.0f, 1.0f), Vec3(0.9f, 0.9f, 0.9f));
 	Light light2(Vec3( 0.0f, 8.0f,  0.0f, 1.0f), Vec3(0.4f, 0.4f, 0.4f));
-	Light light3(Vec3( 5.0f, 6.0f,  5.0f, 1.0f), Vec3(0.2f, 0.2f, 0.6f));
-	Light light4(Vec3( 5.0f, 6.0f, -5.0f, 1.0f), Vec3(0.2f, 0.8f, 0.2f));
-	Light light5(Vec3(-5.0f, 6.0f, -5.0f, 1.0f), Vec3(0.8f, 0.4f, 0.1f));
-	Light light6(Vec3(-5.0f, 6.0f,  5.0f, 1.0f), Vec3(0.2f, 0.1f, 0.1f));
+	Light light3(Vec3( 5.0f, 6.0f,  5.0f, 1.0f), Vec3(0.2f, 0.2f, 0.6f), 10.0f);
+	Light light4(Vec3( 5.0f, 6.0f, -5.0f, 1.0f), Vec3(0.2f, 0.8f, 0.2f), 10.0f);
+	Light light5(Vec3(-5.0f, 6.0f, -5.0f, 1.0f), Vec3(0.8f, 0.4f, 0.1f), 10.0f);
+	Light light6(Vec3(-5.0f, 6.0f,  5.0f, 1.0f), Vec3(0.2f, 0.1f, 0.1f), 10.0f);
 
 	scene->addLight(light1);
 	scene->addLight(light2);
@@ -80,6 +128,9 @@ Station::Station()
   global.maxVisibleLights  = 1; // Initial number of lights.
   global.animate           = true;
   global.drawSilhouettes   = false;
+  global.incrementalSilhouettes = true;
+  global.shadowProxies          = true;
+  global.volumeMethod           = VOLUMES_CPU;
 }
 
 
@@ -121,8 +172,13 @@ void Station::render()
 	renderer->drawText(fps);
   */
 
-  char buff[16];
-  sprintf(buff, "%5d FPS", static_cast<int>(getFps()));
+  char buff[256];
+  sprintf(buff, "%5d FPS  %d of %d shadows culled  %d z-pass  %d z-fail  "
+      "%d silhouette loops  %d indexes saved  %d from proxies",
+      static_cast<int>(getFps()), global.stats.culledVolumes,
+      global.stats.shadowVolumes, global.stats.zPassVolumes,
+      global.stats.zFailVolumes, global.stats.silhouetteLoops,
+      global.stats.savedIndexes, global.stats.proxyVolumes);
   renderer->drawText(string(buff));
 }
 
@@ -217,6 +273,18 @@ void Station::keyDown (const int& key)
     case SDLK_b:
       global.drawPointLights = !global.drawPointLights;
       break;
+
+    case SDLK_i:
+      global.incrementalSilhouettes = !global.incrementalSilhouettes;
+      break;
+
+    case SDLK_p:
+      global.shadowProxies = !global.shadowProxies;
+      break;
+
+    case SDLK_g:
+      global.volumeMethod = (global.volumeMethod + 1) % VOLUME_METHOD_COUNT;
+      break;
   }
 }
 
@@ -0,0 +1,74 @@
+//
+// streambuffer.cpp
+//
+// StreamBuffer implementation.
+//
+
+
+#include "streambuffer.h"
+
+#include <cstddef>
+
+
+// Writes start on this boundary so any kind of data can be streamed.
+static const GLsizeiptr STREAM_ALIGNMENT = 16;
+
+
+//
+// Creates a buffer object for the given target (GL_ARRAY_BUFFER,
+// GL_ELEMENT_ARRAY_BUFFER...) with room for size bytes.
+//
+StreamBuffer::StreamBuffer (const GLenum& target, const GLsizeiptr& size)
+  : target(target), size(size), head(0)
+{
+  glGenBuffers(1, &id);
+  glBindBuffer(target, id);
+  glBufferData(target, size, NULL, GL_STREAM_DRAW);
+  glBindBuffer(target, 0);
+}
+
+
+StreamBuffer::~StreamBuffer (void)
+{
+  glDeleteBuffers(1, &id);
+}
+
+
+//
+// Copies data into the buffer and returns the offset it was written to. The
+// buffer is left bound. Once the end of the buffer is reached, the storage
+// is orphaned and writing starts again from the front. A write larger than
+// the whole buffer grows it.
+//
+GLintptr StreamBuffer::write (const void *data, const GLsizeiptr& bytes)
+{
+  glBindBuffer(target, id);
+
+  if (head + bytes > size)
+  {
+    while (bytes > size)
+      size *= 2;
+
+    glBufferData(target, size, NULL, GL_STREAM_DRAW);
+    head = 0;
+  }
+
+  GLintptr offset = head;
+  glBufferSubData(target, offset, bytes, data);
+
+  head += (bytes + STREAM_ALIGNMENT - 1) & ~(STREAM_ALIGNMENT - 1);
+
+  return offset;
+}
+
+
+void StreamBuffer::bind (void) const
+{
+  glBindBuffer(target, id);
+}
+
+
+void StreamBuffer::unbind (void) const
+{
+  glBindBuffer(target, 0);
+}
@@ -0,0 +1,48 @@
+//
+// streambuffer.h
+//
+// A buffer object for data which is rebuilt every frame, such as the indexes
+// of the shadow volumes. Data is appended to the buffer as a ring, and once
+// it wraps around the old storage is orphaned so the driver never has to wait
+// for draws which are still reading from it.
+//
+
+#ifndef _STREAMBUFFER_H_
+#define _STREAMBUFFER_H_
+
+#define GL_GLEXT_PROTOTYPES
+#include <OpenGL/gl.h>
+
+
+class StreamBuffer
+{
+
+private:
+
+  GLenum target;
+  GLuint id;
+
+  GLsizeiptr size;              // Bytes allocated for the buffer.
+  GLsizeiptr head;              // Where the next write will go.
+
+  // Buffers can't be copied.
+  StreamBuffer (const StreamBuffer&);
+  StreamBuffer& operator= (const StreamBuffer&);
+
+public:
+
+  StreamBuffer (const GLenum& target, const GLsizeiptr& size);
+  ~StreamBuffer (void);
+
+  GLintptr write (const void *data, const GLsizeiptr& bytes);
+
+  void bind (void) const;
+  void unbind (void) const;
+
+  const GLuint& getId (void) const
+  { return id; }
+
+};
+
+
+#endif // _STREAMBUFFER_H_
@@ -0,0 +1,272 @@
+//
+// threadpool.cpp
+//
+// ThreadPool implementation on top of POSIX threads. Each queue has its own
+// lock, so threads only contend when they work on the same queue. The job
+// and sleeper counts are updated with the GCC atomic builtins, which are
+// also full memory barriers.
+//
+
+#include "threadpool.h"
+
+#include <unistd.h>
+
+
+//
+// Starts the worker threads. By default there is one worker less than the
+// number of cores, since the thread which waits on a group helps out.
+//
+ThreadPool::ThreadPool (const int& threadCount)
+  : queued(0), sleepers(0), stopping(false)
+{
+  pthread_mutex_init(&sleepLock, NULL);
+  pthread_cond_init(&wake, NULL);
+  pthread_key_create(&queueKey, NULL);
+
+  int count = threadCount;
+  if (count < 0)
+    count = getCoreCount() - 1;
+
+  // All the queues have to exist before any worker starts stealing.
+  for (int i = 0; i <= count; i++)
+  {
+    WorkQueue *queue = new WorkQueue();
+    queue->pool = this;
+    pthread_mutex_init(&queue->lock, NULL);
+    queues.push_back(queue);
+  }
+
+  for (int i = 1; i <= count; i++)
+  {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, workerMain, queues[i]) == 0)
+      threads.push_back(thread);
+  }
+}
+
+
+//
+// Lets the workers finish whatever is queued and joins them.
+//
+ThreadPool::~ThreadPool (void)
+{
+  pthread_mutex_lock(&sleepLock);
+  stopping = true;
+  pthread_cond_broadcast(&wake);
+  pthread_mutex_unlock(&sleepLock);
+
+  for (int i = 0; i < threads.size(); i++)
+    pthread_join(threads[i], NULL);
+
+  for (int i = 0; i < queues.size(); i++)
+  {
+    pthread_mutex_destroy(&queues[i]->lock);
+    delete queues[i];
+  }
+
+  pthread_key_delete(queueKey);
+  pthread_cond_destroy(&wake);
+  pthread_mutex_destroy(&sleepLock);
+}
+
+
+//
+// The queue belonging to the calling thread.
+//
+ThreadPool::WorkQueue *ThreadPool::getQueue (void)
+{
+  WorkQueue *queue = static_cast<WorkQueue *>(pthread_getspecific(queueKey));
+  return queue ? queue : queues[0];
+}
+
+
+//
+// Takes the newest job off the thread's own queue, or failing that steals
+// the oldest job from one of the others. Returns false if every queue was
+// empty.
+//
+bool ThreadPool::takeJob (WorkQueue *own, Entry& entry)
+{
+  if (__sync_fetch_and_add(&queued, 0) == 0)
+    return false;
+
+  pthread_mutex_lock(&own->lock);
+  if (!own->jobs.empty())
+  {
+    entry = own->jobs.back();
+    own->jobs.pop_back();
+    pthread_mutex_unlock(&own->lock);
+
+    __sync_fetch_and_sub(&queued, 1);
+    return true;
+  }
+  pthread_mutex_unlock(&own->lock);
+
+  // Start at the queue after our own so thieves spread out.
+  int start = 0;
+  while (queues[start] != own)
+    start++;
+
+  for (int i = 1; i < queues.size(); i++)
+  {
+    WorkQueue *victim = queues[(start + i) % queues.size()];
+
+    pthread_mutex_lock(&victim->lock);
+    if (!victim->jobs.empty())
+    {
+      entry = victim->jobs.front();
+      victim->jobs.pop_front();
+      pthread_mutex_unlock(&victim->lock);
+
+      __sync_fetch_and_sub(&queued, 1);
+      return true;
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+
+  return false;
+}
+
+
+//
+// Runs a job and marks it finished in its group. Anyone waiting on the
+// group is woken when it's the last one.
+//
+void ThreadPool::runEntry (const Entry& entry)
+{
+  entry.job->run();
+
+  if (__sync_sub_and_fetch(&entry.group->pending, 1) == 0)
+    wakeSleepers();
+}
+
+
+//
+// Wakes every sleeping thread so it can look for work or check its group.
+// The sleeper count is read after the caller's atomic update, and sleepers
+// check for work after counting themselves in, so a wake up is never lost.
+//
+void ThreadPool::wakeSleepers (void)
+{
+  if (__sync_fetch_and_add(&sleepers, 0) > 0)
+  {
+    pthread_mutex_lock(&sleepLock);
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&sleepLock);
+  }
+}
+
+
+//
+// Worker thread loop, runs and steals jobs until the pool stops.
+//
+void *ThreadPool::workerMain (void *data)
+{
+  WorkQueue *own = static_cast<WorkQueue *>(data);
+  ThreadPool *pool = own->pool;
+
+  pthread_setspecific(pool->queueKey, own);
+
+  for (;;)
+  {
+    Entry entry;
+
+    if (pool->takeJob(own, entry))
+    {
+      pool->runEntry(entry);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->sleepLock);
+    __sync_fetch_and_add(&pool->sleepers, 1);
+
+    while (__sync_fetch_and_add(&pool->queued, 0) == 0 && !pool->stopping)
+      pthread_cond_wait(&pool->wake, &pool->sleepLock);
+
+    __sync_fetch_and_sub(&pool->sleepers, 1);
+    bool done = pool->stopping &&
+      __sync_fetch_and_add(&pool->queued, 0) == 0;
+    pthread_mutex_unlock(&pool->sleepLock);
+
+    if (done)
+      return NULL;
+  }
+}
+
+
+//
+// Queues a job on the calling thread's queue. With no worker threads the job
+// is run straight away.
+//
+void ThreadPool::submit (Job *job, JobGroup& group)
+{
+  Entry entry = { job, &group };
+
+  __sync_fetch_and_add(&group.pending, 1);
+
+  if (threads.empty())
+  {
+    runEntry(entry);
+    return;
+  }
+
+  WorkQueue *own = getQueue();
+
+  pthread_mutex_lock(&own->lock);
+  own->jobs.push_back(entry);
+  pthread_mutex_unlock(&own->lock);
+
+  __sync_fetch_and_add(&queued, 1);
+  wakeSleepers();
+}
+
+
+//
+// Blocks until every job in the group has run. Queued jobs (from any group)
+// are run on this thread in the meantime.
+//
+void ThreadPool::wait (JobGroup& group)
+{
+  WorkQueue *own = getQueue();
+
+  while (__sync_fetch_and_add(&group.pending, 0) > 0)
+  {
+    Entry entry;
+
+    if (takeJob(own, entry))
+    {
+      runEntry(entry);
+      continue;
+    }
+
+    pthread_mutex_lock(&sleepLock);
+    __sync_fetch_and_add(&sleepers, 1);
+
+    while (__sync_fetch_and_add(&queued, 0) == 0 &&
+        __sync_fetch_and_add(&group.pending, 0) > 0)
+      pthread_cond_wait(&wake, &sleepLock);
+
+    __sync_fetch_and_sub(&sleepers, 1);
+    pthread_mutex_unlock(&sleepLock);
+  }
+}
+
+
+//
+// Number of processors available.
+//
+int ThreadPool::getCoreCount (void)
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? cores : 1;
+}
+
+
+//
+// A pool shared by the whole application, created on first use.
+//
+ThreadPool& ThreadPool::getShared (void)
+{
+  static ThreadPool pool;
+  return pool;
+}
@@ -0,0 +1,124 @@
+//
+// threadpool.h
+//
+// A small work stealing pool of worker threads for splitting up CPU heavy
+// work such as model loading and silhouette finding. Work is handed over as
+// Job objects, and every Job belongs to a JobGroup which can be waited on. A
+// thread waiting on a group runs queued jobs itself until the group is done,
+// so jobs may safely submit and wait on jobs of their own.
+//
+
+#ifndef _THREADPOOL_H_
+#define _THREADPOOL_H_
+
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+using std::deque;
+using std::vector;
+
+
+//
+// A unit of work. The pool never takes ownership of a Job, it must stay
+// alive until the group it was submitted with has been waited on.
+//
+class Job
+{
+
+public:
+
+  virtual ~Job (void)
+  { }
+
+  virtual void run (void) = 0;
+
+};
+
+
+//
+// Tracks the number of unfinished jobs submitted with it.
+//
+class JobGroup
+{
+
+private:
+
+  volatile int pending;
+
+  friend class ThreadPool;
+
+public:
+
+  JobGroup (void)
+    : pending(0)
+  { }
+
+};
+
+
+//
+// Every worker thread has its own queue of jobs. A worker takes its newest
+// job first, and when it runs out it steals the oldest job from another
+// queue. Threads outside the pool share one extra queue.
+//
+class ThreadPool
+{
+
+private:
+
+  struct Entry
+  {
+    Job *job;
+    JobGroup *group;
+  };
+
+  struct WorkQueue
+  {
+    ThreadPool *pool;
+    pthread_mutex_t lock;
+    deque<Entry> jobs;
+  };
+
+  vector<pthread_t> threads;
+  vector<WorkQueue *> queues;         // queues[0] is for outside threads.
+  pthread_key_t queueKey;             // The calling thread's WorkQueue.
+
+  volatile int queued;                // Jobs in all the queues.
+  volatile int sleepers;              // Threads waiting on wake.
+
+  pthread_mutex_t sleepLock;
+  pthread_cond_t  wake;
+
+  volatile bool stopping;
+
+  WorkQueue *getQueue (void);
+  bool takeJob (WorkQueue *own, Entry& entry);
+  void runEntry (const Entry& entry);
+  void wakeSleepers (void);
+
+  static void *workerMain (void *queue);
+
+  // Pools can't be copied.
+  ThreadPool (const ThreadPool&);
+  ThreadPool& operator= (const ThreadPool&);
+
+public:
+
+  ThreadPool (const int& threadCount = -1);
+  ~ThreadPool (void);
+
+  void submit (Job *job, JobGroup& group);
+  void wait (JobGroup& group);
+
+  int getThreadCount (void) const
+  { return threads.size(); }
+
+  static int getCoreCount (void);
+  static ThreadPool& getShared (void);
+
+};
+
+
+#endif // _THREADPOOL_H_
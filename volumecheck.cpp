@@ -0,0 +1,526 @@
+//
+// volumecheck.cpp
+//
+// Shadow volume check. Draws the stencil buffer for a grid of casters under
+// a series of random lights and cameras, offscreen, four ways: with the
+// volumes built on the CPU and by the geometry shader in volume.geom, each
+// with z-fail for every caster and with z-pass chosen where the Renderer
+// would choose it. All four should shadow the same pixels. Not a part of the
+// final executable.
+//
+// The two ways of building a volume rasterise different triangles, so
+// pixels within EDGE_MARGIN of a shadow edge are left out, as are pixels
+// beyond a light's radius, which the Renderer never lights.
+//
+// Runs on a surfaceless EGL context (Mesa's llvmpipe will do), so it needs
+// no window. Run it from the top directory, where data/ is. If a number of
+// pixels per unit is given, each caster uses the shadow proxy that
+// Caster::chooseShadowProxy() picks for that scale.
+//
+// Exits with EXIT_FAILURE if any of the stencil buffers differ.
+//
+// Usage: volumecheck model.obj [pixels per unit]
+//
+
+#define GL_GLEXT_PROTOTYPES
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <OpenGL/gl.h>
+#include <OpenGL/glu.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "obj/obj.h"
+#include "model/caster.h"
+#include "material/shader.h"
+#include "math/frustum.h"
+
+
+using namespace std;
+
+
+// Size of the offscreen buffers.
+static const int WIDTH  = 320;
+static const int HEIGHT = 240;
+
+// Lights and cameras tried, each with its own row in the table.
+static const int TRIALS = 24;
+
+// The casters are laid out GRID_SIZE by GRID_SIZE above the floor.
+static const int GRID_SIZE = 4;
+
+// Pixels this close to a change in either of two stencil buffers aren't
+// compared.
+static const int EDGE_MARGIN = 2;
+
+// The Renderer's projection, see renderer.cpp.
+static const float FIELD_OF_VIEW = 45.0f;
+static const float NEAR_PLANE    = 0.1f;
+static const float FAR_PLANE     = 128.0f;
+
+
+//
+// The four ways each stencil buffer is drawn.
+//
+enum VolumeMode
+{
+  CPU_Z_FAIL,                   // CPU volumes, z-fail for every caster.
+  CPU_CHOSEN,                   // CPU volumes, z-pass where possible.
+  SHADER_Z_FAIL,                // Geometry shader, z-fail for every caster.
+  SHADER_CHOSEN,                // Geometry shader, z-pass where possible.
+  VOLUME_MODES
+};
+
+
+//
+// Makes a GL context current without a window or a display server, and an
+// offscreen framebuffer with a depth and stencil buffer to draw into.
+// Returns false if either can't be made.
+//
+static bool createContext (void)
+{
+  PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+      eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (!getPlatformDisplay)
+    return false;
+
+  EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+      EGL_DEFAULT_DISPLAY, NULL);
+  EGLint major, minor;
+  if (!eglInitialize(display, &major, &minor) ||
+      !eglBindAPI(EGL_OPENGL_API))
+    return false;
+
+  // The shaders are written against the compatibility profile.
+  const EGLint attributes[] =
+  {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 2,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK,
+    EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+    EGL_NONE
+  };
+
+  EGLContext context = eglCreateContext(display, NULL, EGL_NO_CONTEXT,
+      attributes);
+  if (context == EGL_NO_CONTEXT ||
+      !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+    return false;
+
+  GLuint framebuffer, buffers[2];
+  glGenFramebuffers(1, &framebuffer);
+  glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+  glGenRenderbuffers(2, buffers);
+
+  glBindRenderbuffer(GL_RENDERBUFFER, buffers[0]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, WIDTH, HEIGHT);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+      GL_RENDERBUFFER, buffers[0]);
+
+  glBindRenderbuffer(GL_RENDERBUFFER, buffers[1]);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, WIDTH, HEIGHT);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+      GL_RENDERBUFFER, buffers[1]);
+
+  glViewport(0, 0, WIDTH, HEIGHT);
+
+  return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+
+//
+// Draws a run of strips or fans from the bound index buffer, one for each
+// count, starting offset bytes into the buffer. See
+// Renderer::drawVolumeRuns().
+//
+static void drawRuns (const GLenum& mode, const vector<GLsizei>& counts,
+    GLintptr offset)
+{
+  if (counts.empty())
+    return;
+
+  vector<const GLvoid *> offsets(counts.size());
+  for (int i = 0; i < counts.size(); i++)
+  {
+    offsets[i] = (const GLvoid *) offset;
+    offset += sizeof(GLuint) * counts[i];
+  }
+
+  glMultiDrawElements(mode, &counts[0], GL_UNSIGNED_INT, &offsets[0],
+      counts.size());
+}
+
+
+//
+// Draws a CPU shadow volume with the caps asked for, as
+// Renderer::drawShadowVolume() does but without keeping anything between
+// draws. The extrude buffer must already be bound.
+//
+static void drawCpuVolume (const ShadowCache& shadow, const bool& lightCap,
+    const bool& darkCap)
+{
+  int first = (darkCap || lightCap) ? shadow.lightCapStart :
+      shadow.darkCapStart;
+  int count = lightCap ? shadow.volume.size() : first;
+
+  if (count == 0)
+    return;
+
+  GLuint buffer;
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * shadow.volume.size(),
+      &shadow.volume[0], GL_STREAM_DRAW);
+
+  drawRuns(shadow.sideMode, shadow.sideCounts, 0);
+
+  if (darkCap || lightCap)
+    drawRuns(GL_TRIANGLE_FAN, shadow.capCounts,
+        sizeof(GLuint) * shadow.darkCapStart);
+
+  if (count > first)
+  {
+    glDepthFunc(GL_NEVER);
+    glDrawElements(GL_TRIANGLES, count - first, GL_UNSIGNED_INT,
+        (const GLvoid *) (sizeof(GLuint) * first));
+    glDepthFunc(GL_LESS);
+  }
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  glDeleteBuffers(1, &buffer);
+}
+
+
+//
+// Draws the shadow volume of every caster the light reaches into the
+// stencil buffer, the same way Renderer::determineShadows() does. Returns
+// the number of casters drawn with z-pass.
+//
+static int drawVolumes (vector<Caster>& casters, const Light& light,
+    const Vec3 *pyramid, const int& pyramidPlanes, const VolumeMode& mode,
+    const ShaderProgram& extrudeShader, const ShaderProgram& volumeShader)
+{
+  bool chosen = (mode == CPU_CHOSEN || mode == SHADER_CHOSEN);
+  bool shader = (mode == SHADER_Z_FAIL || mode == SHADER_CHOSEN);
+  int zPass = 0;
+
+  glClear(GL_STENCIL_BUFFER_BIT);
+
+  for (vector<Caster>::iterator caster = casters.begin();
+      caster != casters.end(); ++caster)
+  {
+    Vec3 center;
+    float radius;
+    caster->getBoundingSphere(center, radius);
+
+    if (!light.reaches(center, radius))
+      continue;
+
+    bool zFail = !chosen || pyramidPlanes == 0 ||
+        Frustum::sphereInside(pyramid, pyramidPlanes, center,
+        radius + NEAR_PLANE);
+
+    if (zFail)
+    {
+      glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+      glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+    }
+    else
+    {
+      glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+      glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+      zPass++;
+    }
+
+    glPushMatrix();
+    const Matrix& localToWorld = caster->getLocalToWorldMatrix();
+    glMultMatrixf(localToWorld.values);
+
+    Matrix worldToLocal = invertMatrix(localToWorld);
+    Vec3 lightPosLocal = light.getPosition();
+    worldToLocal.transform(lightPosLocal);
+
+    Vec3 farPlane = caster->findFarPlane(light, worldToLocal);
+
+    Model *shadowModel = caster->getShadowModel();
+    shadowModel->bindExtrudeBuffer();
+
+    const ShaderProgram& program = shader ? volumeShader : extrudeShader;
+    program.useProgram();
+    glUniform4f(glGetUniformLocation(program.getId(), "lightPos"),
+        lightPosLocal.x, lightPosLocal.y, lightPosLocal.z, lightPosLocal.w);
+    glUniform4fv(glGetUniformLocation(program.getId(), "farPlane"), 1,
+        farPlane.v);
+
+    if (shader)
+    {
+      glUniform1i(glGetUniformLocation(program.getId(), "caps"), zFail);
+      glUniform1i(glGetUniformLocation(program.getId(), "planes"), 0);
+      glUniform1i(glGetUniformLocation(program.getId(), "neighbours"), 1);
+
+      shadowModel->drawShadowFaces();
+    }
+    else
+    {
+      const ShadowCache& shadow = caster->getShadowCache(lightPosLocal, 0,
+          false);
+      drawCpuVolume(shadow, zFail, zFail || farPlane.w > 0.0f);
+    }
+
+    program.disableProgram();
+    glPopMatrix();
+  }
+
+  return zPass;
+}
+
+
+//
+// True if the stencil value at x, y isn't the same shadowed or not as all
+// of its neighbours within EDGE_MARGIN.
+//
+static bool nearEdge (const vector<GLubyte>& stencil, const int& x,
+    const int& y)
+{
+  bool shadowed = stencil[y * WIDTH + x] != 0;
+
+  for (int v = max(y - EDGE_MARGIN, 0); v <= min(y + EDGE_MARGIN, HEIGHT - 1);
+      v++)
+    for (int u = max(x - EDGE_MARGIN, 0); u <= min(x + EDGE_MARGIN, WIDTH - 1);
+        u++)
+      if ((stencil[v * WIDTH + u] != 0) != shadowed)
+        return true;
+
+  return false;
+}
+
+
+//
+// Counts the pixels in the light's reach which are shadowed in one stencil
+// buffer and not the other, away from the shadow edges of both.
+//
+static int countDifferences (const vector<GLubyte>& a,
+    const vector<GLubyte>& b, const vector<bool>& lit)
+{
+  int count = 0;
+
+  for (int y = 0; y < HEIGHT; y++)
+    for (int x = 0; x < WIDTH; x++)
+    {
+      int i = y * WIDTH + x;
+
+      if (lit[i] && (a[i] != 0) != (b[i] != 0) && !nearEdge(a, x, y) &&
+          !nearEdge(b, x, y))
+        count++;
+    }
+
+  return count;
+}
+
+
+//
+// A random number between min and max.
+//
+static float randomRange (const float& min, const float& max)
+{
+  return min + (max - min) * (rand() / (float) RAND_MAX);
+}
+
+
+int main (int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: volumecheck model.obj [pixels per unit]\n");
+    return EXIT_FAILURE;
+  }
+
+  if (!createContext())
+  {
+    fprintf(stderr, "Unable to create an offscreen GL context.\n");
+    return EXIT_FAILURE;
+  }
+
+  ShaderProgram extrudeShader("extrude", "data/shaders/extrude.vert", "");
+  ShaderProgram volumeShader("volume", "data/shaders/volume.vert",
+      "data/shaders/volume.geom", "");
+
+  if (!extrudeShader.isLinked() || !volumeShader.isLinked())
+  {
+    fprintf(stderr, "The shadow volume shaders didn't link.\n");
+    return EXIT_FAILURE;
+  }
+
+  ObjModel model, room;
+  if (model.loadFile(argv[1], OBJ_MAPPED, false) != 0 ||
+      room.loadFile("data/models/interior.obj", OBJ_MAPPED, false) != 0)
+    return EXIT_FAILURE;
+
+  model.initVertexBuffers();
+  room.initVertexBuffers();
+
+  vector<Caster> casters;
+  for (int i = 0; i < GRID_SIZE; i++)
+    for (int j = 0; j < GRID_SIZE; j++)
+      casters.push_back(Caster(&model, Vec3(-7.0f + 4.5f * i,
+          1.5f + (i + j) % 3, -7.0f + 4.5f * j), Vec3(20.0f * i, 30.0f * j,
+          0.0f)));
+
+  if (argc > 2)
+  {
+    float pixelsPerUnit = atof(argv[2]);
+    for (int i = 0; i < casters.size(); i++)
+      casters[i].chooseShadowProxy(pixelsPerUnit);
+
+    printf("Shadows from proxy %d of %d.\n", casters[0].getProxyLevel(),
+        (int) model.shadowProxies.size());
+  }
+
+  glEnable(GL_DEPTH_CLAMP);
+  srand(11);
+
+  printf("trial  radius  z-pass     pixels   shadowed  cpu z-pass  gs z-pass"
+      "  cpu/gs\n");
+
+  bool ok = true;
+
+  for (int trial = 0; trial < TRIALS; trial++)
+  {
+    // Every fourth light is directional, and every other one has a radius.
+    Vec3 lightPos(randomRange(-8.0f, 8.0f), randomRange(5.0f, 11.0f),
+        randomRange(-8.0f, 8.0f), trial % 4 == 3 ? 0.0f : 1.0f);
+    float lightRadius = trial % 2 ? randomRange(9.0f, 15.0f) : 0.0f;
+    Light light(lightPos, Vec3(1.0f, 1.0f, 1.0f), lightRadius);
+
+    // Every third camera sits just behind a caster as seen from the light,
+    // so that the near plane cuts through its shadow volume.
+    Vec3 target = casters[rand() % casters.size()].getTranslation();
+    Vec3 eye;
+
+    if (trial % 3 == 0)
+    {
+      Vec3 toTarget = target - lightPos;
+      eye = lightPos + (1.0f + randomRange(0.0f, 1.2f) / toTarget.mag()) *
+          toTarget;
+    }
+    else
+      eye = Vec3(randomRange(-9.0f, 9.0f), randomRange(1.0f, 13.0f),
+          randomRange(-9.0f, 9.0f));
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(FIELD_OF_VIEW, (double) WIDTH / HEIGHT, NEAR_PLANE,
+        FAR_PLANE);
+
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+    gluLookAt(eye.x, eye.y, eye.z, target.x + 0.3f, target.y - 1.5f,
+        target.z, 0.0f, 1.0f, 0.0f);
+
+    Matrix worldToCam;
+    glGetFloatv(GL_MODELVIEW_MATRIX, worldToCam.values);
+
+    Frustum frustum;
+    frustum.build(invertMatrix(worldToCam), FIELD_OF_VIEW,
+        (float) WIDTH / HEIGHT, NEAR_PLANE, FAR_PLANE);
+
+    Vec3 pyramid[5];
+    int pyramidPlanes = frustum.nearLightPyramid(lightPos, pyramid);
+
+    // Fill the depth buffer with the scene.
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    glDepthMask(1);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LESS);
+    glDisable(GL_STENCIL_TEST);
+    glColorMask(1, 1, 1, 1);
+
+    for (int i = 0; i < casters.size(); i++)
+    {
+      glPushMatrix();
+      glMultMatrixf(casters[i].getLocalToWorldMatrix().values);
+      model.drawVertexBuffers();
+      glPopMatrix();
+    }
+    room.drawVertexBuffers();
+
+    // Only pixels within the light's reach are compared.
+    vector<GLfloat> depth(WIDTH * HEIGHT);
+    glReadPixels(0, 0, WIDTH, HEIGHT, GL_DEPTH_COMPONENT, GL_FLOAT,
+        &depth[0]);
+
+    GLdouble modelview[16], projection[16];
+    GLint viewport[4];
+    glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
+    glGetDoublev(GL_PROJECTION_MATRIX, projection);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    vector<bool> lit(WIDTH * HEIGHT, true);
+    int litCount = WIDTH * HEIGHT;
+
+    if (light.hasRange())
+    {
+      for (int i = 0; i < WIDTH * HEIGHT; i++)
+      {
+        GLdouble x, y, z;
+        gluUnProject(i % WIDTH + 0.5, i / WIDTH + 0.5, depth[i], modelview,
+            projection, viewport, &x, &y, &z);
+
+        if ((Vec3(x, y, z) - lightPos).mag() > lightRadius * 0.999f)
+        {
+          lit[i] = false;
+          litCount--;
+        }
+      }
+    }
+
+    // Draw the volumes each way.
+    glDepthMask(0);
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, 0, ~0);
+    glColorMask(0, 0, 0, 0);
+
+    vector<GLubyte> stencil[VOLUME_MODES];
+    int zPass = 0;
+
+    for (int mode = 0; mode < VOLUME_MODES; mode++)
+    {
+      int n = drawVolumes(casters, light, pyramid, pyramidPlanes,
+          (VolumeMode) mode, extrudeShader, volumeShader);
+      if (mode == CPU_CHOSEN)
+        zPass = n;
+
+      stencil[mode].resize(WIDTH * HEIGHT);
+      glReadPixels(0, 0, WIDTH, HEIGHT, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE,
+          &stencil[mode][0]);
+    }
+
+    int shadowed = 0;
+    for (int i = 0; i < WIDTH * HEIGHT; i++)
+      if (lit[i] && stencil[CPU_Z_FAIL][i] != 0)
+        shadowed++;
+
+    int cpuDiff = countDifferences(stencil[CPU_Z_FAIL], stencil[CPU_CHOSEN],
+        lit);
+    int shaderDiff = countDifferences(stencil[SHADER_Z_FAIL],
+        stencil[SHADER_CHOSEN], lit);
+    int bothDiff = countDifferences(stencil[CPU_Z_FAIL],
+        stencil[SHADER_Z_FAIL], lit);
+
+    printf("%5d %7.1f %7d %10d %10d %11d %10d %7d\n", trial, lightRadius,
+        zPass, litCount, shadowed, cpuDiff, shaderDiff, bothDiff);
+
+    ok = ok && cpuDiff == 0 && shaderDiff == 0 && bothDiff == 0;
+  }
+
+  printf(ok ? "All stencil buffers match.\n" :
+      "Some stencil buffers differ.\n");
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}